@@ -0,0 +1,161 @@
+/*
+ Copyright (c) 2013 NVIDIA Corporation
+ Copyright (c) 2013 Cass Everitt
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+ 
+ Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Headless refinement for offline baking and perf runs: loads a cage,
+// refines it to a level without any GL and writes the result, printing
+// per-phase timings and element counts.
+//
+//   subdiv_batch [-t threads] [-b budget MB] [-limit] [-tiled] [-reorder] [-halfedges] [-quantize] cage level output
+//
+// The output is an OBJ of the target level when it ends in .obj, a level
+// file of the whole chain otherwise. -tiled refines face by face with
+// tiled_refine() instead and streams the tiles to an OBJ in batches of
+// about -b budget MB, see tileBatch, never holding the whole of a level.
+// Tiles are not welded: verts on cage edges repeat in each tile, the
+// count of which is printed, so the OBJ is not the uniform one.
+// -reorder numbers the verts of each level in order
+// of first use by its faces, see reorder_verts(). -halfedges keeps a
+// half-edge view of each level for the limit ring walk, see halfEdges.
+// -quantize stores levels over the -b budget, and an OBJ target level,
+// quantized, see quantize_level(), and reports the error.
+
+#include "subdiv.h"
+
+static void usage() {
+  fprintf( stderr, "usage: subdiv_batch [-t threads] [-b budget MB] [-limit] [-tiled] [-reorder] [-halfedges] [-quantize] cage level output\n" );
+  exit( 1 );
+}
+
+static void print_counts( const char * phase, const subdiv::Model & m, double t ) {
+  printf( "%-8s level %d  verts %10d  faces %10d  edges %10d  %10.2f ms\n", phase, int( m.level ),
+          int( m.quantized ? m.quant.Size() : m.vpos.size() ), int( m.topo.NumFaces() ), int( m.topo.edge.size() ), t * 1e3 );
+}
+
+int main( int argc, const char * argv[] ) {
+  bool tiled = false;
+  int arg = 1;
+  for( ; arg < argc && argv[arg][0] == '-'; arg++ ) {
+    if( strcmp( argv[arg], "-t" ) == 0 && arg + 1 < argc ) {
+      subdiv::workerCount = atoi( argv[ ++arg ] );
+    } else if( strcmp( argv[arg], "-b" ) == 0 && arg + 1 < argc ) {
+      subdiv::levelBudget = size_t( atof( argv[ ++arg ] ) * 1048576.0 );
+    } else if( strcmp( argv[arg], "-limit" ) == 0 ) {
+      subdiv::limitSurface = true;
+    } else if( strcmp( argv[arg], "-tiled" ) == 0 ) {
+      tiled = true;
+    } else if( strcmp( argv[arg], "-reorder" ) == 0 ) {
+      subdiv::reorderVerts = true;
+    } else if( strcmp( argv[arg], "-halfedges" ) == 0 ) {
+      subdiv::halfEdges = true;
+    } else if( strcmp( argv[arg], "-quantize" ) == 0 ) {
+      subdiv::quantizeLevels = true;
+    } else {
+      usage();
+    }
+  }
+  if( argc - arg != 3 ) {
+    usage();
+  }
+  const char * cagePath = argv[ arg ];
+  int level = atoi( argv[ arg + 1 ] );
+  const char * outPath = argv[ arg + 2 ];
+  if( level < 0 ) {
+    usage();
+  }
+
+  double start = subdiv::seconds();
+  subdiv::Model cage;
+  if( ! subdiv::load_cage( cagePath, cage ) ) {
+    return 1;
+  }
+  print_counts( "load", cage, subdiv::seconds() - start );
+
+  if( tiled ) {
+    double t = subdiv::seconds();
+    // a tile vert costs about a position, a normal and a quad
+    if( subdiv::levelBudget ) {
+      subdiv::tileBatch = std::max( size_t( 1 ), subdiv::levelBudget / ( 2 * sizeof( subdiv::Vec3f ) + 4 * sizeof( subdiv::Index ) ) );
+    }
+    subdiv::TiledModel tm;
+    if( ! subdiv::save_tiled_obj( outPath, cage, size_t( level ), tm ) ) {
+      return 1;
+    }
+    printf( "tiled    level %d  verts %10d  faces %10d  tiles %10d  refine+write %10.2f ms\n", level,
+            int( tm.tileVert.back() ), int( tm.tileFace.back() ), int( cage.topo.NumFaces() ),
+            ( subdiv::seconds() - t ) * 1e3 );
+    // tiles are not welded, so the OBJ is not the uniform mesh vert for vert
+    uint64_t uniform = subdiv::uniform_verts( cage.topo, size_t( level ) );
+    printf( "unwelded level %d  verts %10d  uniform %10d  repeated on cage edges %10d\n", level,
+            int( tm.tileVert.back() ), int( uniform ), int( tm.tileVert.back() - uniform ) );
+    printf( "total    %d threads  wall %10.2f ms\n", int( subdiv::worker_threads() ), ( subdiv::seconds() - start ) * 1e3 );
+    return 0;
+  }
+
+  subdiv::Model * m = &cage;
+  subdiv::PhaseTimes total;
+  for( int i = 0; i < level; i++ ) {
+    subdiv::PhaseTimes pt;
+    if( ! subdiv::subdivide_model( *m, &pt ) ) {
+      return 1;
+    }
+    m = m->next;
+    m->lastUse = ++subdiv::levelClock;
+    subdiv::trim_levels( cage, m );
+    print_counts( "refine", *m, pt.Total() );
+    printf( "         split %10.2f ms  average %10.2f ms  normals %10.2f ms\n",
+            pt.split * 1e3, pt.average * 1e3, pt.normals * 1e3 );
+    total.split += pt.split;
+    total.average += pt.average;
+    total.normals += pt.normals;
+  }
+
+  double t = subdiv::seconds();
+  const char * ext = strrchr( outPath, '.' );
+  bool obj = ext && strcasecmp( ext, ".obj" ) == 0;
+  // level files keep exact floats, so only OBJ output is written quantized
+  if( obj && subdiv::quantizeLevels && ! m->quantized ) {
+    size_t bytes = subdiv::resident_bytes( *m );
+    if( subdiv::quantize_level( *m ) ) {
+      printf( "quantize level %d  %10.3f MB -> %10.3f MB  %10.2f ms\n", int( m->level ), bytes / 1048576.0,
+              subdiv::resident_bytes( *m ) / 1048576.0, ( subdiv::seconds() - t ) * 1e3 );
+    }
+    t = subdiv::seconds();
+  }
+  if( obj && m->quantized ) {
+    printf( "         position error %g  normal error %g deg\n", m->quant.posError,
+            m->quant.nrmError * 180.0 / M_PI );
+  }
+  bool ok = obj ? subdiv::save_obj( outPath, *m ) : subdiv::save_levels( outPath, cage, size_t( level ) );
+  if( ! ok ) {
+    return 1;
+  }
+  print_counts( "write", *m, subdiv::seconds() - t );
+  printf( "total    %d threads  split %10.2f ms  average %10.2f ms  normals %10.2f ms  wall %10.2f ms\n",
+          int( subdiv::worker_threads() ), total.split * 1e3, total.average * 1e3, total.normals * 1e3,
+          ( subdiv::seconds() - start ) * 1e3 );
+  return 0;
+}
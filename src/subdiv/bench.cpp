@@ -0,0 +1,296 @@
+/*
+ Copyright (c) 2013 NVIDIA Corporation
+ Copyright (c) 2013 Cass Everitt
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+ 
+ Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Kernel microbenchmarks on synthetic cages: quad grids, tori, capped
+// cylinders with a high-valence apex and an n-gon cap, and heavily
+// creased tori, each at a few sizes. For every level it times
+// split_model, average, compute_normals and derive_topo_from_face_verts
+// producing that level, update_levels down to it after one cage vertex
+// moved ( update1 ), and quantize_level on it and build_draw_vertices
+// decoding it ( quantize and decode, with the quantized level_mb ), best
+// of some runs, and prints one CSV row per kernel so results can be
+// diffed between commits. Each cage runs in its own process, so
+// maxrss_mb is the peak of that cage up to that level.
+// sim_misses counts the misses of a simulated 256 KB, 8-way LRU cache of
+// 64 byte lines over the position gathers of one pass over the level's
+// faces, the access pattern of compute_normals and the next split; run
+// with and without -reorder to compare vertex orders.
+//
+//   subdiv_bench [-t threads] [-l levels] [-r runs] [-reorder] [-halfedges] > bench.csv
+
+#include "subdiv.h"
+#include <sys/resource.h>
+#include <sys/wait.h>
+using namespace std;
+
+using subdiv::Index;
+using subdiv::Model;
+using subdiv::Vec3f;
+
+static void finish_cage( Model & m ) {
+  subdiv::derive_topo_from_face_verts( m.topo, m.vpos.size() );
+  subdiv::compute_normals( m );
+}
+
+static void add_quad( Model & m, Index a, Index b, Index c, Index d ) {
+  Index q[] = { a, b, c, d };
+  m.topo.AddFace( q, 4 );
+}
+
+// n x n quads over the unit square, open boundary.
+static void build_grid( Model & m, size_t n ) {
+  m = Model();
+  for( size_t j = 0; j <= n; j++ ) {
+    for( size_t i = 0; i <= n; i++ ) {
+      m.vpos.push_back( Vec3f( float( i ) / n, float( j ) / n, 0.0f ) );
+    }
+  }
+  for( size_t j = 0; j < n; j++ ) {
+    for( size_t i = 0; i < n; i++ ) {
+      Index v = Index( j * ( n + 1 ) + i );
+      add_quad( m, v, v + 1, Index( v + n + 2 ), Index( v + n + 1 ) );
+    }
+  }
+  finish_cage( m );
+}
+
+// n x n quads wrapped around a torus, every vertex regular.
+static void build_torus( Model & m, size_t n ) {
+  m = Model();
+  for( size_t j = 0; j < n; j++ ) {
+    float v = 2.0f * float( M_PI ) * j / n;
+    for( size_t i = 0; i < n; i++ ) {
+      float u = 2.0f * float( M_PI ) * i / n;
+      float r = 1.0f + 0.3f * cosf( v );
+      m.vpos.push_back( Vec3f( r * cosf( u ), r * sinf( u ), 0.3f * sinf( v ) ) );
+    }
+  }
+  for( size_t j = 0; j < n; j++ ) {
+    for( size_t i = 0; i < n; i++ ) {
+      size_t i1 = ( i + 1 ) % n, j1 = ( j + 1 ) % n;
+      add_quad( m, Index( j * n + i ), Index( j * n + i1 ), Index( j1 * n + i1 ), Index( j1 * n + i ) );
+    }
+  }
+  finish_cage( m );
+}
+
+// A cylinder of n rings of n quads, closed by an n-gon on top and a fan of
+// triangles to an apex of valence n at the bottom.
+static void build_cylinder( Model & m, size_t n ) {
+  m = Model();
+  for( size_t j = 0; j <= n; j++ ) {
+    for( size_t i = 0; i < n; i++ ) {
+      float u = 2.0f * float( M_PI ) * i / n;
+      m.vpos.push_back( Vec3f( cosf( u ), sinf( u ), float( j ) / n ) );
+    }
+  }
+  Index apex = Index( m.vpos.size() );
+  m.vpos.push_back( Vec3f( 0.0f, 0.0f, -0.5f ) );
+  for( size_t j = 0; j < n; j++ ) {
+    for( size_t i = 0; i < n; i++ ) {
+      size_t i1 = ( i + 1 ) % n;
+      add_quad( m, Index( j * n + i ), Index( j * n + i1 ), Index( ( j + 1 ) * n + i1 ), Index( ( j + 1 ) * n + i ) );
+    }
+  }
+  vector<Index> cap( n );
+  for( size_t i = 0; i < n; i++ ) {
+    cap[i] = Index( n * n + i );
+    Index tri[] = { apex, Index( ( i + 1 ) % n ), Index( i ) };
+    m.topo.AddFace( tri, 3 );
+  }
+  m.topo.AddFace( &cap[0], n );
+  finish_cage( m );
+}
+
+// A torus with every edge of every other ring and column creased.
+static void build_creased( Model & m, size_t n ) {
+  build_torus( m, n );
+  for( size_t i = 0; i < m.topo.edge.size(); i++ ) {
+    subdiv::Edge & e = m.topo.edge[i];
+    if( ( e.v0 / n ) % 2 == 0 || ( e.v0 % n ) % 2 == 0 ) {
+      e.crease = 2.5f;
+    }
+  }
+}
+
+struct Cage {
+  const char * name;
+  void ( *build )( Model &, size_t );
+};
+
+static double maxrss_mb() {
+  rusage ru;
+  getrusage( RUSAGE_SELF, &ru );
+#if __APPLE__
+  return ru.ru_maxrss / 1048576.0;
+#else
+  return ru.ru_maxrss / 1024.0;
+#endif
+}
+
+// Set-associative cache with LRU replacement, tags only.
+struct SimCache {
+  enum { LineBytes = 64, Ways = 8, Sets = 512 };
+  vector<size_t> tag;      // Ways per set, most recent first
+  size_t misses;
+  SimCache() : tag( Sets * Ways, ~size_t( 0 ) ), misses( 0 ) {}
+  void Touch( size_t addr ) {
+    size_t line = addr / LineBytes;
+    size_t * set = &tag[ ( line % Sets ) * Ways ];
+    size_t w = 0;
+    while( w < Ways - 1 && set[w] != line ) {
+      w++;
+    }
+    if( set[w] != line ) {
+      misses++;
+    }
+    for( ; w > 0; w-- ) {
+      set[w] = set[ w - 1 ];
+    }
+    set[0] = line;
+  }
+};
+
+static size_t sim_misses( const Model & m ) {
+  SimCache c;
+  const vector<Index> & fv = m.topo.faceVert.index;
+  for( size_t i = 0; i < fv.size(); i++ ) {
+    c.Touch( fv[i] * sizeof( Vec3f ) );
+  }
+  return c.misses;
+}
+
+static void print_row( const char * mesh, size_t cageFaces, const Model & m, const char * kernel, double t, size_t misses ) {
+  size_t faces = m.topo.NumFaces();
+  printf( "%s,%d,%d,%s,%d,%.3f,%.2f,%.2f,%.2f,%d\n", mesh, int( cageFaces ), int( m.level ), kernel,
+          int( faces ), t * 1e3, faces / t * 1e-6, subdiv::resident_bytes( m ) / 1048576.0, maxrss_mb(),
+          int( misses ) );
+}
+
+int main( int argc, const char * argv[] ) {
+  int levels = 3, runs = 3;
+  for( int arg = 1; arg < argc; arg++ ) {
+    if( strcmp( argv[arg], "-t" ) == 0 && arg + 1 < argc ) {
+      subdiv::workerCount = atoi( argv[ ++arg ] );
+    } else if( strcmp( argv[arg], "-l" ) == 0 && arg + 1 < argc ) {
+      levels = atoi( argv[ ++arg ] );
+    } else if( strcmp( argv[arg], "-r" ) == 0 && arg + 1 < argc ) {
+      runs = std::max( 1, atoi( argv[ ++arg ] ) );
+    } else if( strcmp( argv[arg], "-reorder" ) == 0 ) {
+      subdiv::reorderVerts = true;
+    } else if( strcmp( argv[arg], "-halfedges" ) == 0 ) {
+      subdiv::halfEdges = true;
+    } else {
+      fprintf( stderr, "usage: subdiv_bench [-t threads] [-l levels] [-r runs] [-reorder] [-halfedges]\n" );
+      return 1;
+    }
+  }
+
+  static const Cage cages[] = {
+    { "grid", build_grid },
+    { "torus", build_torus },
+    { "cylinder", build_cylinder },
+    { "creased", build_creased },
+  };
+  static const size_t sizes[] = { 16, 64, 256 };
+
+  printf( "# %d threads, %d-bit indices, simd %d, best of %d runs, verts %s%s\n",
+          int( subdiv::worker_threads() ), int( sizeof( Index ) * 8 ), SUBDIV_SIMD, runs,
+          subdiv::reorderVerts ? "reordered" : "in split order",
+          subdiv::halfEdges ? ", half-edges" : "" );
+  printf( "mesh,cage_faces,level,kernel,faces,ms,mfaces_per_s,level_mb,maxrss_mb,sim_misses\n" );
+  for( size_t c = 0; c < sizeof( cages ) / sizeof( cages[0] ); c++ ) {
+    for( size_t s = 0; s < sizeof( sizes ) / sizeof( sizes[0] ); s++ ) {
+      fflush( stdout );
+      pid_t pid = fork();
+      if( pid == 0 ) {
+        Model cage;
+        cages[c].build( cage, sizes[s] );
+        size_t cageFaces = cage.topo.NumFaces();
+        Model * m = &cage;
+        for( int l = 0; l < levels; l++ ) {
+          double split = 1e30, average = 1e30, normals = 1e30, derive = 1e30, update = 1e30;
+          for( int r = 0; r < runs; r++ ) {
+            double t = subdiv::seconds();
+            subdiv::split_model( *m );
+            split = std::min( split, subdiv::seconds() - t );
+            if( m->next == NULL ) {
+              _exit( 1 );
+            }
+            t = subdiv::seconds();
+            subdiv::average( *m->next );
+            average = std::min( average, subdiv::seconds() - t );
+            t = subdiv::seconds();
+            subdiv::compute_normals( *m->next );
+            normals = std::min( normals, subdiv::seconds() - t );
+            subdiv::Topo topo;
+            topo.faceVert = m->next->topo.faceVert;
+            t = subdiv::seconds();
+            subdiv::derive_topo_from_face_verts( topo, m->next->vpos.size() );
+            derive = std::min( derive, subdiv::seconds() - t );
+          }
+          m = m->next;
+          vector<Index> moved( 1, 0 );
+          for( int r = 0; r < runs; r++ ) {
+            cage.vpos[0] += Vec3f( 0.0f, 0.0f, 0.01f );
+            double t = subdiv::seconds();
+            subdiv::update_levels( cage, moved );
+            update = std::min( update, subdiv::seconds() - t );
+          }
+          size_t misses = sim_misses( *m );
+          print_row( cages[c].name, cageFaces, *m, "split", split, misses );
+          print_row( cages[c].name, cageFaces, *m, "average", average, misses );
+          print_row( cages[c].name, cageFaces, *m, "normals", normals, misses );
+          print_row( cages[c].name, cageFaces, *m, "derive", derive, misses );
+          print_row( cages[c].name, cageFaces, *m, "update1", update, misses );
+          double quantize = 1e30, decode = 1e30;
+          for( int r = 0; r < runs; r++ ) {
+            subdiv::touch_level( *m, true );
+            double t = subdiv::seconds();
+            subdiv::quantize_level( *m );
+            quantize = std::min( quantize, subdiv::seconds() - t );
+            subdiv::DrawArrays da;
+            t = subdiv::seconds();
+            subdiv::build_draw_vertices( *m, da );
+            decode = std::min( decode, subdiv::seconds() - t );
+          }
+          print_row( cages[c].name, cageFaces, *m, "quantize", quantize, misses );
+          print_row( cages[c].name, cageFaces, *m, "decode", decode, misses );
+          subdiv::touch_level( *m, true );
+          fflush( stdout );
+        }
+        _exit( 0 );
+      }
+      int status = 0;
+      if( pid < 0 || waitpid( pid, &status, 0 ) != pid || status != 0 ) {
+        fprintf( stderr, "subdiv_bench: %s %d failed\n", cages[c].name, int( sizes[s] ) );
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
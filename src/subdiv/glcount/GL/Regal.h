@@ -0,0 +1,119 @@
+/*
+ Copyright (c) 2013 NVIDIA Corporation
+ Copyright (c) 2013 Cass Everitt
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+ 
+ Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Call-counting stand-in for Regal, for the subdiv_glcount target. It
+// declares just the GL the viewer uses; every call bumps a counter and
+// does nothing else, except glGenBuffers which hands out fresh names. See
+// glut.h here for the loop that drives the viewer and prints the counts.
+
+#ifndef __GLCOUNT_REGAL_H__
+#define __GLCOUNT_REGAL_H__
+
+#include <stddef.h>
+
+typedef unsigned int GLenum;
+typedef unsigned int GLuint;
+typedef unsigned int GLbitfield;
+typedef int GLint;
+typedef int GLsizei;
+typedef float GLfloat;
+typedef double GLdouble;
+typedef ptrdiff_t GLsizeiptr;
+
+enum {
+  GL_POLYGON_OFFSET_FILL = 1, GL_COLOR_MATERIAL, GL_LIGHT0, GL_LIGHTING, GL_DEPTH_TEST, GL_LESS,
+  GL_TRIANGLE_FAN, GL_TRIANGLE_STRIP, GL_TRIANGLES, GL_LINES, GL_POINTS,
+  GL_MODELVIEW, GL_PROJECTION, GL_MODELVIEW_MATRIX, GL_PROJECTION_MATRIX,
+  GL_COLOR_BUFFER_BIT, GL_DEPTH_BUFFER_BIT, GL_FRONT_AND_BACK, GL_SHININESS, GL_SPECULAR, GL_POSITION,
+  GL_ARRAY_BUFFER, GL_ELEMENT_ARRAY_BUFFER, GL_STATIC_DRAW, GL_DYNAMIC_DRAW,
+  GL_FLOAT, GL_UNSIGNED_INT, GL_VERTEX_ARRAY, GL_NORMAL_ARRAY
+};
+
+struct GlCount {
+  size_t calls;      // every GL entry point
+  size_t draws;      // glDrawElements and glDrawArrays
+  size_t vertices;   // immediate mode glVertex3fv
+  size_t uploaded;   // bytes passed to glBufferData
+  GLuint names;
+  void Reset() {
+    calls = draws = vertices = uploaded = 0;
+  }
+};
+
+inline GlCount & gl_count() {
+  static GlCount c = { 0, 0, 0, 0, 0 };
+  return c;
+}
+
+inline void glPolygonOffset( GLfloat, GLfloat ) { gl_count().calls++; }
+inline void glEnable( GLenum ) { gl_count().calls++; }
+inline void glDisable( GLenum ) { gl_count().calls++; }
+inline void glDepthFunc( GLenum ) { gl_count().calls++; }
+inline void glClearColor( GLfloat, GLfloat, GLfloat, GLfloat ) { gl_count().calls++; }
+inline void glClear( GLbitfield ) { gl_count().calls++; }
+inline void glViewport( GLint, GLint, GLsizei, GLsizei ) { gl_count().calls++; }
+inline void glColor3f( GLfloat, GLfloat, GLfloat ) { gl_count().calls++; }
+inline void glColor3fv( const GLfloat * ) { gl_count().calls++; }
+inline void glPointSize( GLfloat ) { gl_count().calls++; }
+inline void glMaterialfv( GLenum, GLenum, const GLfloat * ) { gl_count().calls++; }
+inline void glLightfv( GLenum, GLenum, const GLfloat * ) { gl_count().calls++; }
+inline void glBegin( GLenum ) { gl_count().calls++; }
+inline void glEnd() { gl_count().calls++; }
+inline void glNormal3fv( const GLfloat * ) { gl_count().calls++; }
+inline void glVertex3fv( const GLfloat * ) { gl_count().calls++; gl_count().vertices++; }
+inline void glGetFloatv( GLenum, GLfloat * m ) {
+  gl_count().calls++;
+  for( int i = 0; i < 16; i++ ) {
+    m[i] = i % 5 == 0 ? 1.0f : 0.0f;
+  }
+}
+inline void glMatrixLoadIdentityEXT( GLenum ) { gl_count().calls++; }
+inline void glMatrixFrustumEXT( GLenum, GLdouble, GLdouble, GLdouble, GLdouble, GLdouble, GLdouble ) { gl_count().calls++; }
+inline void glMatrixPushEXT( GLenum ) { gl_count().calls++; }
+inline void glMatrixPopEXT( GLenum ) { gl_count().calls++; }
+inline void glMatrixTranslatefEXT( GLenum, GLfloat, GLfloat, GLfloat ) { gl_count().calls++; }
+inline void glMatrixRotatefEXT( GLenum, GLfloat, GLfloat, GLfloat, GLfloat ) { gl_count().calls++; }
+inline void glGenBuffers( GLsizei n, GLuint * b ) {
+  gl_count().calls++;
+  for( GLsizei i = 0; i < n; i++ ) {
+    b[i] = ++gl_count().names;
+  }
+}
+inline void glDeleteBuffers( GLsizei, const GLuint * ) { gl_count().calls++; }
+inline void glBindBuffer( GLenum, GLuint ) { gl_count().calls++; }
+inline void glBufferData( GLenum, GLsizeiptr size, const void *, GLenum ) {
+  gl_count().calls++;
+  gl_count().uploaded += size_t( size );
+}
+inline void glVertexPointer( GLint, GLenum, GLsizei, const void * ) { gl_count().calls++; }
+inline void glNormalPointer( GLenum, GLsizei, const void * ) { gl_count().calls++; }
+inline void glEnableClientState( GLenum ) { gl_count().calls++; }
+inline void glDisableClientState( GLenum ) { gl_count().calls++; }
+inline void glDrawElements( GLenum, GLsizei, GLenum, const void * ) { gl_count().calls++; gl_count().draws++; }
+inline void glDrawArrays( GLenum, GLint, GLsizei ) { gl_count().calls++; gl_count().draws++; }
+
+#endif // __GLCOUNT_REGAL_H__
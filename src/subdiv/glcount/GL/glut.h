@@ -0,0 +1,96 @@
+/*
+ Copyright (c) 2013 NVIDIA Corporation
+ Copyright (c) 2013 Cass Everitt
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+ 
+ Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Window-less GLUT for the subdiv_glcount target. glutMainLoop() presses
+// the keys of GLCOUNT_KEYS, by default the wireframe and point overlays
+// ( -DGLCOUNT_KEYS='"wpr"' adds the adaptive draw ), then draws the cage
+// and each refined level up to GLCOUNT_LEVELS, stepping with the viewer's
+// 'f' key, and prints the GL counts of a first frame, which builds the level's
+// buffers, and of a second one, which should only draw.
+
+#ifndef __GLCOUNT_GLUT_H__
+#define __GLCOUNT_GLUT_H__
+
+#include "Regal.h"
+#include <stdio.h>
+
+#ifndef GLCOUNT_LEVELS
+#define GLCOUNT_LEVELS 5
+#endif
+
+#ifndef GLCOUNT_KEYS
+#define GLCOUNT_KEYS "wp"
+#endif
+
+enum { GLUT_DOWN, GLUT_UP, GLUT_LEFT_BUTTON, GLUT_MIDDLE_BUTTON, GLUT_RIGHT_BUTTON };
+
+struct GlutCallbacks {
+  void ( *display )();
+  void ( *reshape )( int, int );
+  void ( *keyboard )( unsigned char, int, int );
+};
+
+inline GlutCallbacks & glut_callbacks() {
+  static GlutCallbacks c = { NULL, NULL, NULL };
+  return c;
+}
+
+inline void glutInit( int *, char ** ) {}
+inline void glutInitDisplayString( const char * ) {}
+inline void glutInitWindowSize( int, int ) {}
+inline int glutCreateWindow( const char * ) { return 1; }
+inline void glutDisplayFunc( void ( *f )() ) { glut_callbacks().display = f; }
+inline void glutReshapeFunc( void ( *f )( int, int ) ) { glut_callbacks().reshape = f; }
+inline void glutKeyboardFunc( void ( *f )( unsigned char, int, int ) ) { glut_callbacks().keyboard = f; }
+inline void glutMouseFunc( void ( * )( int, int, int, int ) ) {}
+inline void glutMotionFunc( void ( * )( int, int ) ) {}
+inline void glutIdleFunc( void ( * )() ) {}
+inline void glutPostRedisplay() {}
+inline void glutSwapBuffers() {}
+
+inline void glutMainLoop() {
+  GlutCallbacks & cb = glut_callbacks();
+  GlCount & c = gl_count();
+  cb.reshape( 768, 768 );
+  for( const char * k = GLCOUNT_KEYS; *k; k++ ) {
+    cb.keyboard( (unsigned char)*k, 0, 0 );
+  }
+  for( int level = 0; ; level++ ) {
+    for( int frame = 0; frame < 2; frame++ ) {
+      c.Reset();
+      cb.display();
+      printf( "level %d frame %d: %6d gl calls %4d draws %8d immediate verts %10.1f KB uploaded\n",
+              level, frame, int( c.calls ), int( c.draws ), int( c.vertices ), c.uploaded / 1024.0 );
+    }
+    if( level == GLCOUNT_LEVELS ) {
+      break;
+    }
+    cb.keyboard( 'f', 0, 0 );
+  }
+}
+
+#endif // __GLCOUNT_GLUT_H__
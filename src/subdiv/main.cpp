@@ -28,10 +28,6 @@
 // Simple subdivision surface self-tutorial
 // Cass Everitt - Sept 15, 2013
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <algorithm>
-
 #include <GL/Regal.h>
 #include <GL/RegalCGL.h>
 
@@ -42,340 +38,19 @@
 #endif
 //#include <GL/RegalGLUT.h>
 
-
-// subdiv data structures
-#include "r3/linear.h"
-#include <vector>
-#include <map>
-#include <set>
+#include "subdiv.h"
 using namespace std;
 
-namespace subdiv {
-
-  typedef r3::Vec3f Vec3f;
-
-  struct Vertex {
-    vector<size_t> edgeIndex;
-    vector<size_t> faceIndex;
-  };
-  
-  struct Edge {
-    Edge() : v0( ~0 ), v1( ~0 ), f0( ~0 ), f1( ~0 ), crease( 0.0f ) {}
-    Edge( size_t vi0, size_t vi1, size_t face ) : crease( 0.0f ) {
-      if( vi0 < vi1 ) {
-        v0 = vi0;
-        v1 = vi1;
-        f0 = face;
-        f1 = ~0;
-      } else {
-        v1 = vi0;
-        v0 = vi1;
-        f0 = ~0;
-        f1 = face;
-      }
-    }
-    void AddFace( size_t vi0, size_t vi1, size_t face ) {
-      if( vi0 < vi1 ) {
-        assert( f0 == ~0 );
-        f0 = face;
-      } else {
-        assert( f1 == ~0 );
-        f1 = face;
-      }
-    }
-    size_t v0, v1;
-    size_t f0, f1;
-    float crease;
-  };
-  bool operator<( const Edge & a, const Edge & b ) {
-    return a.v0 < b.v0 || ( ( a.v0 == b.v0 ) && ( a.v1 < b.v1 ) );
-  }
-  
-  struct Face {
-    vector<size_t> vertIndex;
-    vector<size_t> edgeIndex;
-  };
-  
-  struct Topo {
-    vector<Vertex> vert;
-    vector<Face> face;
-    vector<Edge> edge;
-    map<Edge,size_t> edgeMap;
-    Edge * FindEdge( size_t v0, size_t v1 ) {
-      Edge e( v0, v1, 0 );
-      map<Edge,size_t>::iterator i = edgeMap.find( e );
-      if( i != edgeMap.end() ) {
-        return &edge[ i->second ];
-      }
-      return NULL;
-    }
-  };
-  
-  struct Model {
-    Model() : prev(NULL), next(NULL), level(0) {}
-    ~Model() {
-      if( next != 0 ) {
-        delete next;
-      }
-    }
-    vector<Vec3f> vpos;
-    vector<Vec3f> vnrm;
-    vector<Vec3f> fnrm;
-    Topo topo;
-    Model *prev;
-    Model *next;
-    size_t level;
-  };
-  
-  
-  //
-
-  void compute_normals( Model & m ) {
-    m.fnrm.resize( m.topo.face.size() );
-    for( size_t i = 0; i < m.fnrm.size(); i++ ) {
-      Face & f = m.topo.face[i];
-      Vec3f & v0 = m.vpos[ f.vertIndex[0] ];
-      Vec3f n(0,0,0);
-      for( size_t j = 1; j < f.vertIndex.size() - 1; j++ ) {
-        Vec3f & v1 = m.vpos[ f.vertIndex[j] ];
-        Vec3f & v2 = m.vpos[ f.vertIndex[j+1] ];
-        Vec3f tn = (v1-v0).Cross( v2-v0 );
-        tn.Normalize();
-        n+= tn;
-      }
-      n.Normalize();
-      m.fnrm[ i ] = n;
-    }
-    
-    m.vnrm.resize( m.vpos.size() );
-    
-    for( size_t i = 0; i < m.vnrm.size(); i++ ) {
-      Vertex & v = m.topo.vert[ i ];
-      size_t faces = v.faceIndex.size();
-      Vec3f n(0,0,0);
-      for( size_t j = 0; j < faces; j++ ) {
-        n += m.fnrm[ v.faceIndex[ j ] ];
-      }
-      n.Normalize();
-      m.vnrm[ i ] = n;
-    }
-  }
-  
-  void average( Model & m ) {
-    if( m.prev == NULL ) {
-      return;
-    }
-    Model & prev = *m.prev;
-    size_t pv = prev.topo.vert.size(); // previous verts
-    size_t pf = prev.topo.face.size(); // previous faces
-    size_t pe = prev.topo.edge.size(); // previous edges
-
-    m.vpos.resize( m.topo.vert.size() );
-    
-    // per-face verts
-    for( size_t i = 0; i < pf; i++ ) {
-      Vec3f p( 0, 0, 0);
-      Face & f = prev.topo.face[i];
-      size_t fv = f.vertIndex.size();
-      for( size_t j = 0; j < fv; j++ ) {
-        p += prev.vpos[ f.vertIndex[ j ] ];
-      }
-      p /= float( fv );
-      m.vpos[ pv + i ] = p;
-    }
-
-    // per-edge verts
-    for( size_t i = 0; i < pe; i++ ) {
-      Edge & e = prev.topo.edge[ i ];
-      Vec3f p = prev.vpos[ e.v0 ];
-      size_t count = 1;
-      p += prev.vpos[ e.v1 ];
-      count++;
-      if( e.crease == 0.0f ) {
-        if( e.f0 != ~0 ) {
-          p += m.vpos[ pv + e.f0 ];
-          count++;
-        }
-        if( e.f1 != ~0 ) {
-          p += m.vpos[ pv + e.f1 ];
-          count++;
-        }
-      }
-      p /= count;
-      m.vpos[ pv + pf + i ] = p;
-    }
-    
-    // original verts
-    for( size_t i = 0; i < pv; i++ ) {
-      Vertex & ov = prev.topo.vert[i];
-      size_t valence = ov.edgeIndex.size();
-      Vec3f fp(0, 0, 0);
-      Vec3f rp(0, 0, 0);
-      bool creased = false;
-      for( size_t j = 0; j < valence; j++ ) {
-        Edge & e = prev.topo.edge[ ov.edgeIndex[j] ];
-        rp += ( prev.vpos[ e.v0 ] + prev.vpos[ e.v1 ] ) / 2.0f;
-        if( e.crease > 0.0f ) {
-          creased = true;
-        }
-      }
-      if( ! creased ) {
-        rp /= valence;
-        for( size_t j = 0; j < ov.faceIndex.size(); j++ ) {
-          fp += m.vpos[ pv + ov.faceIndex[j] ];
-        }
-        fp /= ov.faceIndex.size();
-        Vec3f p = fp + rp * 2.0f + prev.vpos[i] * float( valence - 3 );
-        p /= valence;
-        m.vpos[i] = p;
-      } else {
-        m.vpos[i] = prev.vpos[i];
-      }
-    }
-    
-    
-  }
-
-  void derive_topo_from_face_verts( Topo & t ) {
-    map<Edge, size_t> & em = t.edgeMap;
-    size_t maxvert = 0;
-    for( int i = 0; i < t.face.size(); i++ ) {
-      Face &f = t.face[i];
-      assert( f.vertIndex.size() > 2 );
-      for( int j = 0; j < f.vertIndex.size(); j++ ) {
-        size_t j0 = f.vertIndex[ j ];
-        size_t j1 = f.vertIndex[ ( j + 1 ) % f.vertIndex.size() ];
-        Edge e( j0, j1, i );
-        size_t eidx = ~0;
-        if( em.count( e ) != 0 ) {
-          eidx = em[e];
-          Edge & ee = t.edge[ eidx ];
-          ee.AddFace( j0, j1, i );
-        } else {
-          eidx = em[e] = (int)t.edge.size();
-          t.edge.push_back( e );
-        }
-        f.edgeIndex.push_back( eidx );
-        maxvert = max( maxvert, j0 );
-      }
-    }
-    t.vert.resize( maxvert + 1 );
-    for( int i = 0; i < t.face.size(); i++ ) {
-      Face &f = t.face[i];
-      for( int j = 0; j < f.vertIndex.size(); j++ ) {
-        t.vert[ f.vertIndex[ j ] ].faceIndex.push_back( i );
-      }
-    }
-    for( int i = 0; i < t.edge.size(); i++ ) {
-      Edge &e = t.edge[i];
-      assert( e.v0 >= 0 );
-      assert( e.v1 >= 0 );
-      t.vert[ e.v0 ].edgeIndex.push_back( i );
-      t.vert[ e.v1 ].edgeIndex.push_back( i );
-    }
-  }
-
-
-  void split_model( Model & m ) {
-    delete m.next;
-    m.next = new Model();
-    m.next->prev = &m;
-    m.next->level = m.level + 1;
-    Model &r = *m.next;
-    size_t pv = m.topo.vert.size(); // previous verts
-    size_t pf = m.topo.face.size(); // previous faces
-    size_t pe = m.topo.edge.size(); // previous faces
-    
-    // populate faces
-    size_t fb = pv;        // base offset for newly added per-face vertexes
-    size_t eb = pv + pf;   // base offset for newly added per-edge vertexes
-
-    // refined mesh faces
-    for( size_t i = 0; i < pf; i++ ) {
-      Face &f = m.topo.face[i];
-      size_t fv = f.vertIndex.size();
-      if( fv == 4 ) { // ordinary
-        Face rf;
-        // quad 00
-        rf.vertIndex.push_back( f.vertIndex[0] );
-        rf.vertIndex.push_back( eb + f.edgeIndex[0] );
-        rf.vertIndex.push_back( fb + i );
-        rf.vertIndex.push_back( eb + f.edgeIndex[3] );
-        r.topo.face.push_back( rf );
-        // quad 01
-        rf = Face();
-        rf.vertIndex.push_back( eb + f.edgeIndex[0] );
-        rf.vertIndex.push_back( f.vertIndex[1] );
-        rf.vertIndex.push_back( eb + f.edgeIndex[1] );
-        rf.vertIndex.push_back( fb + i );
-        r.topo.face.push_back( rf );
-        // quad 11
-        rf = Face();
-        rf.vertIndex.push_back( fb + i );
-        rf.vertIndex.push_back( eb + f.edgeIndex[1] );
-        rf.vertIndex.push_back( f.vertIndex[2] );
-        rf.vertIndex.push_back( eb + f.edgeIndex[2] );
-        r.topo.face.push_back( rf );
-        // quad 10
-        rf = Face();
-        rf.vertIndex.push_back( eb + f.edgeIndex[3] );
-        rf.vertIndex.push_back( fb + i );
-        rf.vertIndex.push_back( eb + f.edgeIndex[2] );
-        rf.vertIndex.push_back( f.vertIndex[3] );
-        r.topo.face.push_back( rf );
-      } else { // extra-ordinary
-        for( size_t j = 0; j < fv; j++ ) {
-          size_t e0 = f.edgeIndex[j];
-          size_t e1 = f.edgeIndex[ (j + 1) % fv ];
-          Face rf;
-          rf.vertIndex.push_back( f.vertIndex[j] );
-          rf.vertIndex.push_back( eb + e0 );
-          rf.vertIndex.push_back( fb + i );
-          rf.vertIndex.push_back( eb + e1 );
-          r.topo.face.push_back( rf );
-        }
-      }
-    }
-    derive_topo_from_face_verts( r.topo );    
- 
-    for( size_t i = 0; i < pe; i++ ) {
-      Vertex & v = r.topo.vert[ eb + i ];
-      size_t idx[2];
-      size_t children[2];
-      int curr_idx = 0;
-      for( size_t j = 0; j < v.edgeIndex.size() && curr_idx < 2; j++ ) {
-        Edge & e = r.topo.edge[ v.edgeIndex[ j ] ];
-        if( e.v0 < pv ) {
-          idx[ curr_idx ] = e.v0;
-          children[ curr_idx ] = v.edgeIndex[j];
-          curr_idx++;
-        }
-      }
-      assert( curr_idx == 2 );
-      Edge e( idx[0], idx[1], 0 );
-      assert( m.topo.edgeMap.count( e ) > 0 );
-      size_t parent = m.topo.edgeMap[ e ];
-      Edge &pe = m.topo.edge[ parent ];
-      float crease = std::max( 0.0f, pe.crease - 1.0f);
-      Edge &e0 = r.topo.edge[ children[ 0 ] ];
-      Edge &e1 = r.topo.edge[ children[ 1 ] ];
-      e0.crease = e1.crease = crease;
-    }
+subdiv::Model *model;
+const char * levelPath = "subdiv.levels";
 
+subdiv::Model * cage_of( subdiv::Model * m ) {
+  while( m->prev ) {
+    m = m->prev;
   }
-  
-  void subdivide_model( Model & m ) {
-    split_model( m );
-    if( m.next != NULL ) {
-      average( *m.next );
-      compute_normals( *m.next );
-    }
-  }
-
+  return m;
 }
 
-subdiv::Model *model;
-
 
 void build_subdiv_cube( subdiv::Model & m ) {
   m = subdiv::Model();
@@ -388,49 +63,25 @@ void build_subdiv_cube( subdiv::Model & m ) {
   m.vpos.push_back( r3::Vec3f(  1,  1, -1 ) );
   m.vpos.push_back( r3::Vec3f( -1,  1, -1 ) );
   // +z
-  subdiv::Face f;
-  f.vertIndex.push_back( 0 );
-  f.vertIndex.push_back( 1 );
-  f.vertIndex.push_back( 2 );
-  f.vertIndex.push_back( 3 );
-  m.topo.face.push_back( f );
+  subdiv::Index pz[] = { 0, 1, 2, 3 };
+  m.topo.AddFace( pz, 4 );
   // -z
-  f = subdiv::Face();
-  f.vertIndex.push_back( 5 );
-  f.vertIndex.push_back( 4 );
-  f.vertIndex.push_back( 7 );
-  f.vertIndex.push_back( 6 );
-  m.topo.face.push_back( f );
+  subdiv::Index nz[] = { 5, 4, 7, 6 };
+  m.topo.AddFace( nz, 4 );
   // +x
-  f = subdiv::Face();
-  f.vertIndex.push_back( 1 );
-  f.vertIndex.push_back( 5 );
-  f.vertIndex.push_back( 6 );
-  f.vertIndex.push_back( 2 );
-  m.topo.face.push_back( f );
+  subdiv::Index px[] = { 1, 5, 6, 2 };
+  m.topo.AddFace( px, 4 );
   // -x
-  f = subdiv::Face();
-  f.vertIndex.push_back( 4 );
-  f.vertIndex.push_back( 0 );
-  f.vertIndex.push_back( 3 );
-  f.vertIndex.push_back( 7 );
-  m.topo.face.push_back( f );
+  subdiv::Index nx[] = { 4, 0, 3, 7 };
+  m.topo.AddFace( nx, 4 );
   // +y
-  f = subdiv::Face();
-  f.vertIndex.push_back( 3 );
-  f.vertIndex.push_back( 2 );
-  f.vertIndex.push_back( 6 );
-  f.vertIndex.push_back( 7 );
-  m.topo.face.push_back( f );
+  subdiv::Index py[] = { 3, 2, 6, 7 };
+  m.topo.AddFace( py, 4 );
   // -y
-  f = subdiv::Face();
-  f.vertIndex.push_back( 4 );
-  f.vertIndex.push_back( 5 );
-  f.vertIndex.push_back( 1 );
-  f.vertIndex.push_back( 0 );
-  m.topo.face.push_back( f );
+  subdiv::Index ny[] = { 4, 5, 1, 0 };
+  m.topo.AddFace( ny, 4 );
   
-  derive_topo_from_face_verts( m.topo );
+  derive_topo_from_face_verts( m.topo, m.vpos.size() );
   compute_normals( m );
   subdiv::Edge *ep = m.topo.FindEdge( 0, 1 );
   assert( ep );
@@ -451,51 +102,289 @@ r3::Rotationf rot;
 
 
 
-void draw_model( subdiv::Model & m ) {
-  glPolygonOffset( 1, 1 );
-  glEnable( GL_POLYGON_OFFSET_FILL );
-  glEnable( GL_COLOR_MATERIAL );
-  glEnable( GL_LIGHT0 );
-  glEnable( GL_LIGHTING );
-  glColor3f( 0, 0, 1 );
-  for( int i = 0; i < m.topo.face.size(); i++ ) {
-    subdiv::Face &f = m.topo.face[i];
+void draw_faces( const subdiv::Model & m, size_t begin, size_t end ) {
+  for( size_t i = begin; i < end; i++ ) {
+    const subdiv::Index *f = m.topo.faceVert.Begin( i );
     glBegin( GL_TRIANGLE_FAN );
-    for( int j = 0; j < f.vertIndex.size(); j++) {
-      size_t vi = f.vertIndex[j];
-      r3::Vec3f c = m.vnrm[ vi ];
+    for( size_t j = 0; j < m.topo.faceVert.Count( i ); j++ ) {
+      size_t vi = f[j];
+      r3::Vec3f n = m.quantized ? m.quant.Normal( vi ) : m.vnrm[ vi ];
+      r3::Vec3f p = m.quantized ? m.quant.Position( vi ) : m.vpos[ vi ];
+      r3::Vec3f c = n;
       c *= 0.5;
       c += 0.5;
       //glColor3fv( c.Ptr() );
-      glNormal3fv( m.vnrm[ vi ].Ptr() );
-      glVertex3fv( m.vpos[ vi ].Ptr() );
+      glNormal3fv( n.Ptr() );
+      glVertex3fv( p.Ptr() );
     }
     glEnd();
   }
+}
+
+// Retained-mode buffers of one level: interleaved position / normal in
+// vbo, triangles in ibo[0] and edges in ibo[1]. Rebuilt lazily when the
+// topology or vertex stamp of the level moves on.
+struct LevelBuffers {
+  LevelBuffers() : vbo( 0 ), verts( 0 ), topoStamp( 0 ), vertStamp( 0 ) {
+    ibo[0] = ibo[1] = 0;
+    count[0] = count[1] = 0;
+  }
+  GLuint vbo, ibo[2];
+  GLsizei count[2], verts;
+  size_t topoStamp, vertStamp;
+};
+map<const subdiv::Model *, LevelBuffers> levelBuffers;
+
+void upload_indices( LevelBuffers & lb, const subdiv::DrawArrays & da ) {
+  glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, lb.ibo[0] );
+  glBufferData( GL_ELEMENT_ARRAY_BUFFER, da.tris.size() * sizeof( uint32_t ), da.tris.empty() ? NULL : &da.tris[0], GL_STATIC_DRAW );
+  glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, lb.ibo[1] );
+  glBufferData( GL_ELEMENT_ARRAY_BUFFER, da.lines.size() * sizeof( uint32_t ), da.lines.empty() ? NULL : &da.lines[0], GL_STATIC_DRAW );
+  glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
+  lb.count[0] = GLsizei( da.tris.size() );
+  lb.count[1] = GLsizei( da.lines.size() );
+}
+
+void upload_vertices( LevelBuffers & lb, const subdiv::DrawArrays & da, GLenum usage ) {
+  glBindBuffer( GL_ARRAY_BUFFER, lb.vbo );
+  glBufferData( GL_ARRAY_BUFFER, da.vertex.size() * sizeof( float ), da.vertex.empty() ? NULL : &da.vertex[0], usage );
+  glBindBuffer( GL_ARRAY_BUFFER, 0 );
+  lb.verts = GLsizei( da.vertex.size() / 6 );
+}
+
+LevelBuffers & buffers_for( const subdiv::Model & m ) {
+  // drop buffers of levels no longer in the chain
+  map<const subdiv::Model *, LevelBuffers>::iterator it = levelBuffers.begin();
+  while( it != levelBuffers.end() ) {
+    const subdiv::Model *c = &m;
+    while( c->prev ) {
+      c = c->prev;
+    }
+    while( c != NULL && c != it->first ) {
+      c = c->next;
+    }
+    if( c == NULL ) {
+      glDeleteBuffers( 1, &it->second.vbo );
+      glDeleteBuffers( 2, it->second.ibo );
+      levelBuffers.erase( it++ );
+    } else {
+      ++it;
+    }
+  }
+
+  LevelBuffers &lb = levelBuffers[ &m ];
+  subdiv::DrawArrays da;
+  if( lb.vbo == 0 ) {
+    glGenBuffers( 1, &lb.vbo );
+    glGenBuffers( 2, lb.ibo );
+  }
+  if( lb.topoStamp != m.topo.stamp ) {
+    subdiv::build_draw_indices( m.topo, da );
+    upload_indices( lb, da );
+    lb.topoStamp = m.topo.stamp;
+  }
+  if( lb.vertStamp != m.stamp ) {
+    subdiv::build_draw_vertices( m, da );
+    upload_vertices( lb, da, GL_DYNAMIC_DRAW );
+    lb.vertStamp = m.stamp;
+  }
+  return lb;
+}
+
+void draw_buffers( const LevelBuffers & lb ) {
+  glBindBuffer( GL_ARRAY_BUFFER, lb.vbo );
+  glVertexPointer( 3, GL_FLOAT, 6 * sizeof( float ), (const void *)0 );
+  glNormalPointer( GL_FLOAT, 6 * sizeof( float ), (const void *)( 3 * sizeof( float ) ) );
+  glEnableClientState( GL_VERTEX_ARRAY );
+  glEnableClientState( GL_NORMAL_ARRAY );
+
+  glPolygonOffset( 1, 1 );
+  glEnable( GL_POLYGON_OFFSET_FILL );
+  glEnable( GL_COLOR_MATERIAL );
+  glEnable( GL_LIGHT0 );
+  glEnable( GL_LIGHTING );
+  glColor3f( 0, 0, 1 );
+  glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, lb.ibo[0] );
+  glDrawElements( GL_TRIANGLES, lb.count[0], GL_UNSIGNED_INT, (const void *)0 );
   glDisable( GL_LIGHTING );
   glDisable( GL_POLYGON_OFFSET_FILL );
+  glDisableClientState( GL_NORMAL_ARRAY );
 
   if( b['w'] ) {
     glColor3f( 0.4, 0.4, 0.4 );
-    glBegin( GL_LINES );
-    for( int i = 0; i < m.topo.edge.size(); i++ ) {
-      subdiv::Edge &e = m.topo.edge[i];
-      glVertex3fv( m.vpos[ e.v0 ].Ptr() );
-      glVertex3fv( m.vpos[ e.v1 ].Ptr() );
-    }
-    glEnd();
+    glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, lb.ibo[1] );
+    glDrawElements( GL_LINES, lb.count[1], GL_UNSIGNED_INT, (const void *)0 );
   }
   
   if( b['p'] ) {
     glColor3f( .5, .5, 0 );
     glPointSize( 3 );
-    glBegin( GL_POINTS );
-    for( int i = 0; i < m.vpos.size(); i++ ) {
-      glVertex3fv( m.vpos[ i ].Ptr() );
+    glDrawArrays( GL_POINTS, 0, lb.verts );
+  }
+
+  glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
+  glBindBuffer( GL_ARRAY_BUFFER, 0 );
+  glDisableClientState( GL_VERTEX_ARRAY );
+}
+
+void draw_model( subdiv::Model & m ) {
+  draw_buffers( buffers_for( m ) );
+}
+
+
+// 'r' draws the model level feature-adaptively: regular regions as
+// tessellated patches, only the faces around features refined all the way.
+// Refined and tessellated into buffers when the level or the cage changes.
+subdiv::AdaptiveModel adaptive;
+subdiv::Model *adaptiveModel = NULL;
+size_t adaptiveUniformLevels = 0;
+size_t adaptiveStamp = 0;
+LevelBuffers adaptiveBuffers;
+
+void draw_adaptive( subdiv::Model & m ) {
+  const subdiv::Model *cage = cage_of( &m );
+  if( adaptiveModel != &m || adaptiveStamp != cage->stamp ) {
+    subdiv::adaptive_refine( *cage, m.level, adaptiveUniformLevels, adaptive );
+    adaptiveModel = &m;
+    adaptiveStamp = cage->stamp;
+    printf( "Adaptive level %d: %d faces, %d patches ( uniform %d faces )\n", (int)m.level,
+            (int)adaptive.NumFaces(), (int)adaptive.patch.size(), (int)m.topo.NumFaces() );
+    subdiv::DrawArrays da;
+    subdiv::build_adaptive_draw( adaptive, da );
+    if( adaptiveBuffers.vbo == 0 ) {
+      glGenBuffers( 1, &adaptiveBuffers.vbo );
+      glGenBuffers( 2, adaptiveBuffers.ibo );
+    }
+    upload_indices( adaptiveBuffers, da );
+    upload_vertices( adaptiveBuffers, da, GL_STATIC_DRAW );
+  }
+  draw_buffers( adaptiveBuffers );
+}
+
+
+// 'l' draws each cage face at the level that makes its edges about
+// lodPixels long on screen, refining the chain up to lodMaxLevel on demand,
+// and skips faces outside the view frustum. Neighbours are kept within a
+// level of each other and the finer side of each seam is snapped onto the
+// coarser one, so the seams don't crack.
+float lodPixels = 8.0f;
+int lodMaxLevel = 5;
+
+// Cage features of each level draw_lod() stitches, rebuilt when the
+// topology of the level moves on.
+struct LevelFeatures {
+  LevelFeatures() : topoStamp( 0 ), ok( false ) {}
+  subdiv::CageFeatures cf;
+  size_t topoStamp;
+  bool ok;
+};
+map<const subdiv::Model *, LevelFeatures> levelFeatures;
+
+// Draws faces begin to end of m like draw_faces(), with the verts on cage
+// features whose coarsest drawn level, in coarsest, is below that of m
+// moved to the midpoint of their parents in coarse.
+void draw_stitched_faces( const subdiv::Model & m, const subdiv::Model & coarse, const subdiv::CageFeatures & cf,
+                          const vector<int> & coarsest, size_t begin, size_t end ) {
+  for( size_t i = begin; i < end; i++ ) {
+    const subdiv::Index *f = m.topo.faceVert.Begin( i );
+    glBegin( GL_TRIANGLE_FAN );
+    for( size_t j = 0; j < m.topo.faceVert.Count( i ); j++ ) {
+      size_t vi = f[j];
+      r3::Vec3f n, p;
+      subdiv::Index feature = cf.feature[ vi ];
+      if( feature != subdiv::InvalidIndex && coarsest[ feature ] < int( m.level ) ) {
+        size_t a = cf.parent[ 2 * vi ], b = cf.parent[ 2 * vi + 1 ];
+        n = coarse.quantized ? coarse.quant.Normal( a ) + coarse.quant.Normal( b ) : coarse.vnrm[ a ] + coarse.vnrm[ b ];
+        n.Normalize();
+        p = coarse.quantized ? coarse.quant.Position( a ) + coarse.quant.Position( b ) : coarse.vpos[ a ] + coarse.vpos[ b ];
+        p *= 0.5f;
+      } else {
+        n = m.quantized ? m.quant.Normal( vi ) : m.vnrm[ vi ];
+        p = m.quantized ? m.quant.Position( vi ) : m.vpos[ vi ];
+      }
+      glNormal3fv( n.Ptr() );
+      glVertex3fv( p.Ptr() );
     }
     glEnd();
   }
-  
+}
+
+void draw_lod( subdiv::Model & m ) {
+  subdiv::Model *cage = cage_of( &m );
+  vector<subdiv::Model *> levels( 1, cage );
+  while( int( levels.size() ) <= lodMaxLevel ) {
+    if( levels.back()->next == NULL ) {
+      subdiv::subdivide_model( *levels.back() );
+      if( levels.back()->next == NULL ) {
+        break;
+      }
+    }
+    levels.push_back( &subdiv::touch_level( *levels.back()->next ) );
+  }
+
+  GLfloat mv[16], proj[16], mvp[16];
+  glGetFloatv( GL_MODELVIEW_MATRIX, mv );
+  glGetFloatv( GL_PROJECTION_MATRIX, proj );
+  for( int c = 0; c < 4; c++ ) {
+    for( int r = 0; r < 4; r++ ) {
+      mvp[ c * 4 + r ] = 0.0f;
+      for( int k = 0; k < 4; k++ ) {
+        mvp[ c * 4 + r ] += proj[ k * 4 + r ] * mv[ c * 4 + k ];
+      }
+    }
+  }
+  vector<int> lod;
+  subdiv::select_lod( *cage, mvp, width, height, lodPixels, int( levels.size() ) - 1, lod );
+  subdiv::limit_lod_steps( cage->topo, lod );
+
+  // the coarsest drawn level around each cage vert and along each cage edge
+  const subdiv::Topo & ct = cage->topo;
+  size_t cageVerts = ct.NumVerts();
+  vector<int> coarsest( cageVerts + ct.edge.size(), int( levels.size() ) );
+  for( size_t i = 0; i < lod.size(); i++ ) {
+    if( lod[i] < 0 ) {
+      continue;
+    }
+    const subdiv::Index *q = ct.faceVert.Begin( i ), *qe = ct.faceEdge.Begin( i );
+    for( size_t j = 0; j < ct.faceVert.Count( i ); j++ ) {
+      coarsest[ q[j] ] = min( coarsest[ q[j] ], lod[i] );
+      coarsest[ cageVerts + qe[j] ] = min( coarsest[ cageVerts + qe[j] ], lod[i] );
+    }
+  }
+  vector<const subdiv::CageFeatures *> features( levels.size(), (const subdiv::CageFeatures *)NULL );
+  subdiv::CageFeatures none;
+  for( size_t l = 1; l < levels.size(); l++ ) {
+    LevelFeatures & lf = levelFeatures[ levels[l] ];
+    if( lf.topoStamp != levels[l]->topo.stamp ) {
+      lf.ok = ( l == 1 || features[ l - 1 ] != NULL ) &&
+              subdiv::refine_features( levels[ l - 1 ]->topo, l == 1 ? none : *features[ l - 1 ], cageVerts,
+                                       levels[l]->topo, lf.cf );
+      lf.topoStamp = levels[l]->topo.stamp;
+    }
+    features[l] = lf.ok ? &lf.cf : NULL;
+  }
+
+  glPolygonOffset( 1, 1 );
+  glEnable( GL_POLYGON_OFFSET_FILL );
+  glEnable( GL_COLOR_MATERIAL );
+  glEnable( GL_LIGHT0 );
+  glEnable( GL_LIGHTING );
+  glColor3f( 0, 0, 1 );
+  for( size_t i = 0; i < lod.size(); i++ ) {
+    if( lod[i] < 0 ) {
+      continue;
+    }
+    size_t begin, end;
+    subdiv::descendant_faces( cage->topo, i, lod[i], begin, end );
+    if( lod[i] > 0 && features[ lod[i] ] != NULL ) {
+      draw_stitched_faces( *levels[ lod[i] ], *levels[ lod[i] - 1 ], *features[ lod[i] ], coarsest, begin, end );
+    } else {
+      draw_faces( *levels[ lod[i] ], begin, end );
+    }
+  }
+  glDisable( GL_LIGHTING );
+  glDisable( GL_POLYGON_OFFSET_FILL );
+  subdiv::trim_levels( *cage, &m );
 }
 
 
@@ -574,7 +463,14 @@ static void display() {
   float angle;
   rot.GetValue( axis, angle );
   glMatrixRotatefEXT( GL_MODELVIEW, r3::ToDegrees( angle ), axis.x, axis.y, axis.z );
-  draw_model( *model );
+  subdiv::touch_level( *model );
+  if( b['l'] ) {
+    draw_lod( *model );
+  } else if( b['r'] ) {
+    draw_adaptive( *model );
+  } else {
+    draw_model( *model );
+  }
   glMatrixPopEXT( GL_MODELVIEW );
   
   glutSwapBuffers();
@@ -591,6 +487,90 @@ static void init_opengl() {
   glLightfv( GL_LIGHT0, GL_POSITION, lightpos );
 }
 
+// 'a' wobbles the cage and re-evaluates the displayed level through its
+// stencil table instead of re-running the refinement
+subdiv::StencilTable stencils;
+subdiv::Model *stencilModel = NULL;
+vector<r3::Vec3f> restCage;
+float animTime = 0.0f;
+
+static void animate() {
+  subdiv::Model *cage = cage_of( model );
+  if( stencilModel != model ) {
+    if( ! subdiv::build_stencil_table( *cage, model->level, stencils ) ) {
+      return;
+    }
+    stencilModel = model;
+  }
+  if( model->quantized ) {
+    subdiv::touch_level( *model, true );
+  }
+  animTime += 0.05f;
+  for( size_t i = 0; i < cage->vpos.size(); i++ ) {
+    cage->vpos[i] = restCage[i] * ( 1.0f + 0.15f * sin( animTime + i ) );
+  }
+  if( model != cage ) {
+    subdiv::apply_stencils( stencils, cage->vpos, model->vpos );
+    subdiv::to_soa( model->vpos, model->spos );
+  }
+  subdiv::finish_level( *model );
+  glutPostRedisplay();
+}
+
+// Re-derives the refined levels from m on, after the cage moved or the
+// limit surface was toggled.
+static void refresh_levels( subdiv::Model *m, bool average ) {
+  for( ; m != NULL; m = m->next ) {
+    // evicted levels are re-derived from scratch when touched
+    if( m->evicted ) {
+      continue;
+    }
+    // quantized levels get exact data back from the refreshed level above
+    if( m->quantized ) {
+      subdiv::touch_level( *m, true );
+      continue;
+    }
+    if( average ) {
+      subdiv::touch_level( *m->prev, true );
+      subdiv::average( *m );
+    } else {
+      subdiv::to_aos( m->spos, m->vpos );
+    }
+    subdiv::finish_level( *m );
+  }
+}
+
+static void toggle_animation( bool on ) {
+  subdiv::Model *cage = cage_of( model );
+  if( on ) {
+    restCage = cage->vpos;
+    glutIdleFunc( animate );
+  } else {
+    glutIdleFunc( NULL );
+    cage->vpos = restCage;
+    subdiv::compute_normals( *cage );
+    refresh_levels( cage->next, true );
+  }
+}
+
+// 'e' pulls a cage vertex out along its normal, the next one each time,
+// and updates only the parts of the refined levels that depend on it
+size_t editVert = 0;
+
+static void edit_vertex() {
+  subdiv::Model *cage = cage_of( model );
+  if( b['a'] || cage->vpos.empty() ) {
+    return;
+  }
+  editVert = ( editVert + 1 ) % cage->vpos.size();
+  cage->vpos[ editVert ] += cage->vnrm[ editVert ] * 0.1f;
+  vector<subdiv::Index> moved( 1, subdiv::Index( editVert ) );
+  double t = subdiv::seconds();
+  subdiv::update_levels( *cage, moved );
+  printf( "Moved cage vertex %d, levels updated in %.2f ms\n", int( editVert ), ( subdiv::seconds() - t ) * 1e3 );
+  adaptiveModel = NULL;
+}
+
 static void keyboard(unsigned char c, int x, int y) {
   b[c] = ! b[c];
   switch (c)
@@ -601,7 +581,8 @@ static void keyboard(unsigned char c, int x, int y) {
       break;
     case 'c':
       if( model->level > 0 ) {
-        model = model->prev;
+        model = &subdiv::touch_level( *model->prev );
+        subdiv::trim_levels( *cage_of( model ), model );
       }
       printf( "Model level = %d\n", (int)model->level );
       break;
@@ -610,12 +591,51 @@ static void keyboard(unsigned char c, int x, int y) {
         subdiv::subdivide_model( *model );
       }
       if( model->next ) {
-        model = model->next;
+        model = &subdiv::touch_level( *model->next );
+        subdiv::trim_levels( *cage_of( model ), model );
       }
       printf( "Model level = %d\n", (int)model->level );
       break;
     case 's':
       subdiv::subdivide_model( *model );
+      stencilModel = NULL;
+      adaptiveModel = NULL;
+      break;
+    case 'a':
+      toggle_animation( b['a'] );
+      break;
+    case 'e':
+      edit_vertex();
+      break;
+    case 'm':
+      subdiv::limitSurface = b['m'];
+      refresh_levels( cage_of( model )->next, false );
+      printf( "Limit surface %s\n", b['m'] ? "on" : "off" );
+      break;
+    case 'b':
+      subdiv::report_levels( *cage_of( model ) );
+      break;
+    case 'z':
+      // quantize the displayed level, and others over the budget, or
+      // restore its exact data
+      subdiv::quantizeLevels = b['z'];
+      if( b['z'] && subdiv::quantize_level( *model ) ) {
+        printf( "Quantized level %d, position error %g, normal error %g deg\n", (int)model->level,
+                model->quant.posError, model->quant.nrmError * 180.0 / M_PI );
+      } else if( ! b['z'] && model->quantized ) {
+        subdiv::touch_level( *model, true );
+      }
+      subdiv::trim_levels( *cage_of( model ), model );
+      break;
+    case 'k':
+      if( subdiv::save_levels( levelPath, *cage_of( model ), model->level ) ) {
+        printf( "Saved levels 0-%d to %s\n", (int)model->level, levelPath );
+      }
+      break;
+    case 't':
+      subdiv::report_speedup( *model );
+      stencilModel = NULL;
+      adaptiveModel = NULL;
       break;
     default:
       break;
@@ -630,6 +650,17 @@ int main(int argc, const char * argv[]) {
   glutInit( &argc, (char **) argv);
   glutCreateWindow( "subdiv" );
 
+  // optional worker thread count for refinement, all cores by default,
+  // byte budget in MB for the refined levels, unbounded by default, an
+  // OBJ or COLLADA cage to load instead of the cube, and a level file
+  // written by 'k' and loaded, when present, instead of the cage
+  if( argc > 1 ) {
+    subdiv::workerCount = atoi( argv[1] );
+  }
+  if( argc > 2 ) {
+    subdiv::levelBudget = size_t( atof( argv[2] ) * 1048576.0 );
+  }
+
 #if REGAL_SYS_OSX
   // Regal workaround for OSX GLUT
   RegalMakeCurrent(CGLGetCurrentContext());
@@ -638,7 +669,14 @@ int main(int argc, const char * argv[]) {
   init_opengl();
   
   model = new subdiv::Model();
-  build_subdiv_cube( *model );
+  if( argc > 4 ) {
+    levelPath = argv[4];
+  }
+  if( argc > 4 && access( levelPath, R_OK ) == 0 && subdiv::load_levels( levelPath, *model ) ) {
+    printf( "Loaded levels from %s\n", levelPath );
+  } else if( argc < 4 || ! subdiv::load_cage( argv[3], *model ) ) {
+    build_subdiv_cube( *model );
+  }
   
   glutMouseFunc( mouse );
   glutMotionFunc( motion );
@@ -0,0 +1,4120 @@
+/*
+ Copyright (c) 2013 NVIDIA Corporation
+ Copyright (c) 2013 Cass Everitt
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without modification,
+ are permitted provided that the following conditions are met:
+ 
+ Redistributions of source code must retain the above copyright notice, this
+ list of conditions and the following disclaimer.
+ 
+ Redistributions in binary form must reproduce the above copyright notice,
+ this list of conditions and the following disclaimer in the documentation
+ and/or other materials provided with the distribution.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Subdivision engine: topology, refinement, normals and cage and level
+// file IO, with no GL or window system dependency. It is all defined
+// here, so include it from a single translation unit per program.
+
+#ifndef __SUBDIV_H__
+#define __SUBDIV_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <algorithm>
+
+#if defined( __AVX2__ )
+#include <immintrin.h>
+#define SUBDIV_SIMD 8
+#elif defined( __SSE2__ )
+#include <emmintrin.h>
+#define SUBDIV_SIMD 4
+#else
+#define SUBDIV_SIMD 0
+#endif
+
+#include "r3/linear.h"
+#include "tinyxml2.h"
+#include <vector>
+#include <map>
+#include <set>
+
+namespace subdiv {
+
+  using namespace std;
+
+  typedef r3::Vec3f Vec3f;
+
+  // Topology index type, 32 bits unless built with -DSUBDIV_INDEX64.
+  // split_model fails cleanly for a level whose counts would not fit.
+#if SUBDIV_INDEX64
+  typedef uint64_t Index;
+#else
+  typedef uint32_t Index;
+#endif
+  const Index InvalidIndex = Index( ~Index( 0 ) );
+
+  // parallel helpers
+
+  size_t num_threads() {
+    long n = sysconf( _SC_NPROCESSORS_ONLN );
+    return n > 0 ? size_t( n ) : 1;
+  }
+
+  double seconds() {
+    timeval tv;
+    gettimeofday( &tv, NULL );
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+  }
+
+  pthread_key_t create_chunk_key() {
+    pthread_key_t key;
+    pthread_key_create( &key, NULL );
+    return key;
+  }
+
+  // Set on a thread while it runs a parallel_for chunk.
+  pthread_key_t chunkKey = create_chunk_key();
+
+  bool in_parallel_chunk() {
+    return pthread_getspecific( chunkKey ) != NULL;
+  }
+
+  // Worker threads used by the refinement phases, 0 means one per core
+  // and 1 runs everything serially on the calling thread. Loops nested in
+  // a parallel_for chunk run serially on its thread.
+  size_t workerCount = 0;
+
+  size_t worker_threads() {
+    if( in_parallel_chunk() ) {
+      return 1;
+    }
+    return workerCount ? workerCount : num_threads();
+  }
+
+  // Number of chunks parallel_for splits count items into, at least grain
+  // items each.
+  size_t parallel_chunks( size_t count, size_t threads, size_t grain = 4096 ) {
+    return std::max( size_t( 1 ), std::min( threads, count / grain ) );
+  }
+
+  template< typename Body >
+  struct ParallelChunk {
+    Body * body;
+    size_t begin, end, thread;
+    static void * Run( void * arg ) {
+      ParallelChunk * c = (ParallelChunk *)arg;
+      void * outer = pthread_getspecific( chunkKey );
+      pthread_setspecific( chunkKey, c );
+      (*c->body)( c->begin, c->end, c->thread );
+      pthread_setspecific( chunkKey, outer );
+      return NULL;
+    }
+  };
+
+  // Calls body( begin, end, thread ) on contiguous chunks of [0,count),
+  // one chunk per thread. Small counts just run on the calling thread.
+  template< typename Body >
+  void parallel_for( size_t count, size_t threads, Body & body, size_t grain = 4096 ) {
+    threads = parallel_chunks( count, threads, grain );
+    if( threads == 1 ) {
+      body( 0, count, 0 );
+      return;
+    }
+    vector< ParallelChunk<Body> > chunk( threads );
+    vector<pthread_t> tid( threads );
+    for( size_t t = 0; t < threads; t++ ) {
+      chunk[t].body = &body;
+      chunk[t].begin = count * t / threads;
+      chunk[t].end = count * ( t + 1 ) / threads;
+      chunk[t].thread = t;
+    }
+    for( size_t t = 1; t < threads; t++ ) {
+      pthread_create( &tid[t], NULL, ParallelChunk<Body>::Run, &chunk[t] );
+    }
+    ParallelChunk<Body>::Run( &chunk[0] );
+    for( size_t t = 1; t < threads; t++ ) {
+      pthread_join( tid[t], NULL );
+    }
+  }
+
+  // (key, value) pair sorted by the radix sort below
+  struct KeyIndex {
+    uint64_t key;
+    size_t index;
+  };
+
+  struct RadixHistogram {
+    const KeyIndex * src;
+    size_t shift;
+    vector<size_t> * count;  // 256 per chunk
+    void operator()( size_t begin, size_t end, size_t t ) {
+      size_t * c = &(*count)[ t * 256 ];
+      for( size_t i = begin; i < end; i++ ) {
+        c[ ( src[i].key >> shift ) & 0xff ]++;
+      }
+    }
+  };
+
+  struct RadixScatter {
+    const KeyIndex * src;
+    KeyIndex * dst;
+    size_t shift;
+    vector<size_t> * offset; // 256 per chunk
+    void operator()( size_t begin, size_t end, size_t t ) {
+      size_t * o = &(*offset)[ t * 256 ];
+      for( size_t i = begin; i < end; i++ ) {
+        dst[ o[ ( src[i].key >> shift ) & 0xff ]++ ] = src[i];
+      }
+    }
+  };
+
+  // Stable LSD radix sort on the low keybits of each key, 8 bits per pass.
+  // Every pass histograms and scatters in parallel, one chunk per thread.
+  void radix_sort( vector<KeyIndex> & a, int keybits ) {
+    size_t n = a.size();
+    size_t threads = worker_threads();
+    size_t chunks = parallel_chunks( n, threads );
+    vector<KeyIndex> tmp( n );
+    vector<size_t> count( chunks * 256 );
+    KeyIndex * src = n ? &a[0] : NULL;
+    KeyIndex * dst = n ? &tmp[0] : NULL;
+    for( int shift = 0; shift < keybits; shift += 8 ) {
+      std::fill( count.begin(), count.end(), 0 );
+      RadixHistogram h = { src, size_t( shift ), &count };
+      parallel_for( n, threads, h );
+      size_t sum = 0;
+      for( size_t d = 0; d < 256; d++ ) {
+        for( size_t t = 0; t < chunks; t++ ) {
+          size_t c = count[ t * 256 + d ];
+          count[ t * 256 + d ] = sum;
+          sum += c;
+        }
+      }
+      RadixScatter s = { src, dst, size_t( shift ), &count };
+      parallel_for( n, threads, s );
+      std::swap( src, dst );
+    }
+    if( n && src != &a[0] ) {
+      a.swap( tmp );
+    }
+  }
+
+  // simd helpers, so the averaging kernels are written once for both widths
+
+#if SUBDIV_SIMD == 8
+  typedef __m256 vfloat;
+  inline vfloat vset1( float f ) { return _mm256_set1_ps( f ); }
+  inline vfloat vload( const float * p ) { return _mm256_loadu_ps( p ); }
+  inline void vstore( float * p, vfloat a ) { _mm256_storeu_ps( p, a ); }
+  inline vfloat vadd( vfloat a, vfloat b ) { return _mm256_add_ps( a, b ); }
+  inline vfloat vsub( vfloat a, vfloat b ) { return _mm256_sub_ps( a, b ); }
+  inline vfloat vmul( vfloat a, vfloat b ) { return _mm256_mul_ps( a, b ); }
+  inline vfloat vdiv( vfloat a, vfloat b ) { return _mm256_div_ps( a, b ); }
+  inline vfloat vmax( vfloat a, vfloat b ) { return _mm256_max_ps( a, b ); }
+  inline vfloat vand( vfloat a, vfloat b ) { return _mm256_and_ps( a, b ); }
+  inline vfloat vcmpeq( vfloat a, vfloat b ) { return _mm256_cmp_ps( a, b, _CMP_EQ_OQ ); }
+  inline vfloat vcmpgt( vfloat a, vfloat b ) { return _mm256_cmp_ps( a, b, _CMP_GT_OQ ); }
+  inline vfloat vrsqrt( vfloat a ) { return _mm256_rsqrt_ps( a ); }
+  // mask ? a : b
+  inline vfloat vselect( vfloat mask, vfloat a, vfloat b ) { return _mm256_blendv_ps( b, a, mask ); }
+  inline vfloat vgather( const float * base, const Index * lane ) {
+#if SUBDIV_INDEX64
+    return _mm256_set_ps( base[ lane[7] ], base[ lane[6] ], base[ lane[5] ], base[ lane[4] ],
+                          base[ lane[3] ], base[ lane[2] ], base[ lane[1] ], base[ lane[0] ] );
+#else
+    return _mm256_i32gather_ps( base, _mm256_loadu_si256( (const __m256i *)lane ), 4 );
+#endif
+  }
+#elif SUBDIV_SIMD == 4
+  typedef __m128 vfloat;
+  inline vfloat vset1( float f ) { return _mm_set1_ps( f ); }
+  inline vfloat vload( const float * p ) { return _mm_loadu_ps( p ); }
+  inline void vstore( float * p, vfloat a ) { _mm_storeu_ps( p, a ); }
+  inline vfloat vadd( vfloat a, vfloat b ) { return _mm_add_ps( a, b ); }
+  inline vfloat vsub( vfloat a, vfloat b ) { return _mm_sub_ps( a, b ); }
+  inline vfloat vmul( vfloat a, vfloat b ) { return _mm_mul_ps( a, b ); }
+  inline vfloat vdiv( vfloat a, vfloat b ) { return _mm_div_ps( a, b ); }
+  inline vfloat vmax( vfloat a, vfloat b ) { return _mm_max_ps( a, b ); }
+  inline vfloat vand( vfloat a, vfloat b ) { return _mm_and_ps( a, b ); }
+  inline vfloat vcmpeq( vfloat a, vfloat b ) { return _mm_cmpeq_ps( a, b ); }
+  inline vfloat vcmpgt( vfloat a, vfloat b ) { return _mm_cmpgt_ps( a, b ); }
+  inline vfloat vrsqrt( vfloat a ) { return _mm_rsqrt_ps( a ); }
+  // mask ? a : b
+  inline vfloat vselect( vfloat mask, vfloat a, vfloat b ) {
+    return _mm_or_ps( _mm_and_ps( mask, a ), _mm_andnot_ps( mask, b ) );
+  }
+  inline vfloat vgather( const float * base, const Index * lane ) {
+    return _mm_set_ps( base[ lane[3] ], base[ lane[2] ], base[ lane[1] ], base[ lane[0] ] );
+  }
+#endif
+
+#if SUBDIV_SIMD
+  // x, y and z of the Vec3f at base[ lane[k] ] in lane k
+  inline void vgather3( const Vec3f * base, const Index * lane, vfloat & x, vfloat & y, vfloat & z ) {
+    float gx[ SUBDIV_SIMD ], gy[ SUBDIV_SIMD ], gz[ SUBDIV_SIMD ];
+    for( size_t k = 0; k < SUBDIV_SIMD; k++ ) {
+      const Vec3f & v = base[ lane[k] ];
+      gx[k] = v.x;
+      gy[k] = v.y;
+      gz[k] = v.z;
+    }
+    x = vload( gx );
+    y = vload( gy );
+    z = vload( gz );
+  }
+
+  inline void vscatter3( Vec3f * base, size_t i, vfloat x, vfloat y, vfloat z ) {
+    float sx[ SUBDIV_SIMD ], sy[ SUBDIV_SIMD ], sz[ SUBDIV_SIMD ];
+    vstore( sx, x );
+    vstore( sy, y );
+    vstore( sz, z );
+    for( size_t k = 0; k < SUBDIV_SIMD; k++ ) {
+      base[ i + k ] = Vec3f( sx[k], sy[k], sz[k] );
+    }
+  }
+
+  // Scales ( x, y, z ) to unit length with the rsqrt estimate and one Newton
+  // step, leaving zero vectors zero.
+  inline void vnormalize( vfloat & x, vfloat & y, vfloat & z ) {
+    vfloat zero = vset1( 0.0f );
+    vfloat d = vadd( vadd( vmul( x, x ), vmul( y, y ) ), vmul( z, z ) );
+    vfloat r = vrsqrt( d );
+    r = vmul( r, vsub( vset1( 1.5f ), vmul( vmul( vset1( 0.5f ), d ), vmul( r, r ) ) ) );
+    r = vselect( vcmpgt( d, zero ), r, zero );
+    x = vmul( x, r );
+    y = vmul( y, r );
+    z = vmul( z, r );
+  }
+#endif
+
+  // Structure-of-arrays copy of a position stream.
+  struct Vec3fSoa {
+    vector<float> x, y, z;
+    size_t Size() const {
+      return x.size();
+    }
+    void Resize( size_t n ) {
+      x.resize( n );
+      y.resize( n );
+      z.resize( n );
+    }
+    void Set( size_t i, const Vec3f & v ) {
+      x[i] = v.x;
+      y[i] = v.y;
+      z[i] = v.z;
+    }
+    Vec3f Get( size_t i ) const {
+      return Vec3f( x[i], y[i], z[i] );
+    }
+    size_t Bytes() const {
+      return ( x.capacity() + y.capacity() + z.capacity() ) * sizeof( float );
+    }
+    void Release() {
+      vector<float>().swap( x );
+      vector<float>().swap( y );
+      vector<float>().swap( z );
+    }
+  };
+
+  void to_soa( const vector<Vec3f> & aos, Vec3fSoa & soa ) {
+    soa.Resize( aos.size() );
+    for( size_t i = 0; i < aos.size(); i++ ) {
+      soa.Set( i, aos[i] );
+    }
+  }
+
+  void to_aos( const Vec3fSoa & soa, vector<Vec3f> & aos ) {
+    aos.resize( soa.Size() );
+    for( size_t i = 0; i < aos.size(); i++ ) {
+      aos[i] = soa.Get( i );
+    }
+  }
+
+  // Compressed-sparse-row adjacency. The neighbors of element i are
+  // index[ offset[i] ] .. index[ offset[i+1] - 1 ].
+  struct Csr {
+    vector<Index> offset;
+    vector<Index> index;
+    size_t Size() const {
+      return offset.empty() ? 0 : offset.size() - 1;
+    }
+    size_t Count( size_t i ) const {
+      return offset[ i + 1 ] - offset[i];
+    }
+    const Index * Begin( size_t i ) const {
+      return index.empty() ? NULL : &index[0] + offset[i];
+    }
+    Index * Begin( size_t i ) {
+      return index.empty() ? NULL : &index[0] + offset[i];
+    }
+    void Clear() {
+      offset.assign( 1, 0 );
+      index.clear();
+    }
+    void Append( const Index * idx, size_t count ) {
+      if( offset.empty() ) {
+        offset.push_back( 0 );
+      }
+      index.insert( index.end(), idx, idx + count );
+      offset.push_back( index.size() );
+    }
+    size_t Bytes() const {
+      return ( offset.capacity() + index.capacity() ) * sizeof( Index );
+    }
+    void Release() {
+      vector<Index>().swap( offset );
+      vector<Index>().swap( index );
+    }
+  };
+
+  // Fills out with the transpose of in ( row i of out lists every row of in
+  // that references i ) by counting sort, so rows come out in increasing order.
+  void transpose_csr( const Csr & in, size_t outRows, Csr & out ) {
+    out.offset.assign( outRows + 1, 0 );
+    for( size_t i = 0; i < in.index.size(); i++ ) {
+      out.offset[ in.index[i] + 1 ]++;
+    }
+    for( size_t i = 0; i < outRows; i++ ) {
+      out.offset[ i + 1 ] += out.offset[i];
+    }
+    out.index.resize( in.index.size() );
+    vector<Index> fill( out.offset.begin(), out.offset.end() - 1 );
+    for( size_t i = 0; i < in.Size(); i++ ) {
+      for( size_t j = in.offset[i]; j < in.offset[ i + 1 ]; j++ ) {
+        out.index[ fill[ in.index[j] ]++ ] = i;
+      }
+    }
+  }
+
+  // Per-element adjacency, only kept as a compatibility view of Topo.
+  struct Vertex {
+    vector<Index> edgeIndex;
+    vector<Index> faceIndex;
+  };
+  
+  struct Edge {
+    Edge() : v0( InvalidIndex ), v1( InvalidIndex ), f0( InvalidIndex ), f1( InvalidIndex ), crease( 0.0f ) {}
+    Edge( Index vi0, Index vi1, Index face ) : crease( 0.0f ) {
+      if( vi0 < vi1 ) {
+        v0 = vi0;
+        v1 = vi1;
+        f0 = face;
+        f1 = InvalidIndex;
+      } else {
+        v1 = vi0;
+        v0 = vi1;
+        f0 = InvalidIndex;
+        f1 = face;
+      }
+    }
+    void AddFace( Index vi0, Index vi1, Index face ) {
+      if( vi0 < vi1 ) {
+        assert( f0 == InvalidIndex );
+        f0 = face;
+      } else {
+        assert( f1 == InvalidIndex );
+        f1 = face;
+      }
+    }
+    Index v0, v1;
+    Index f0, f1;
+    float crease;
+  };
+  bool operator<( const Edge & a, const Edge & b ) {
+    return a.v0 < b.v0 || ( ( a.v0 == b.v0 ) && ( a.v1 < b.v1 ) );
+  }
+  
+  struct Face {
+    vector<Index> vertIndex;
+    vector<Index> edgeIndex;
+  };
+  
+  // Change stamps are unique across all models, so caches of derived data
+  // such as draw buffers can tell a level from an older one at its address.
+  size_t changeStamp = 0;
+
+  size_t next_stamp() {
+    return ++changeStamp;
+  }
+
+  // Adjacency is stored as flat CSR arrays. faceVert is the input, set with
+  // AddFace(), the rest is filled by derive_topo_from_face_verts(), or
+  // directly by split_model() for refined levels.
+  // FindEdge scans the vertEdge row of the lower vertex.
+  // edgeMap is an optional side index, only filled by BuildEdgeMap(), and
+  // twin, cornerFace and vertOut an optional half-edge view, only filled by
+  // build_half_edges().
+  struct Topo {
+    Topo() : stamp( 0 ), reordered( false ) {}
+    Csr faceVert;
+    Csr faceEdge;
+    Csr vertFace;
+    Csr vertEdge;
+    vector<Edge> edge;
+    map<Edge,size_t> edgeMap;
+    vector<Index> vertOrder;  // vert of each split slot, see reorder_verts()
+    vector<Index> twin;       // per corner, see build_half_edges()
+    vector<Index> cornerFace;
+    vector<Index> vertOut;
+    size_t stamp;      // of the last adjacency build
+    bool reordered;    // kept across Release(), so a re-split matches
+    size_t NumFaces() const {
+      return faceVert.Size();
+    }
+    size_t NumVerts() const {
+      return vertFace.Size();
+    }
+    void AddFace( const Index * vi, size_t count ) {
+      assert( count > 2 );
+      faceVert.Append( vi, count );
+    }
+    bool HasHalfEdges() const {
+      return ! twin.empty() && twin.size() == faceVert.index.size();
+    }
+    // the face of corner h and the corners after and before it
+    Index CornerFace( Index h ) const {
+      return cornerFace.empty() ? h / 4 : cornerFace[h];
+    }
+    Index Next( Index h ) const {
+      if( cornerFace.empty() ) {
+        return ( h & ~Index( 3 ) ) | ( ( h + 1 ) & 3 );
+      }
+      Index f = cornerFace[h];
+      return h + 1 == faceVert.offset[ f + 1 ] ? faceVert.offset[f] : h + 1;
+    }
+    Index Prev( Index h ) const {
+      if( cornerFace.empty() ) {
+        return ( h & ~Index( 3 ) ) | ( ( h + 3 ) & 3 );
+      }
+      Index f = cornerFace[h];
+      return h == faceVert.offset[f] ? faceVert.offset[ f + 1 ] - 1 : h - 1;
+    }
+    Edge * FindEdge( Index v0, Index v1 ) {
+      Edge e( v0, v1, 0 );
+      if( e.v0 >= NumVerts() ) {
+        return NULL;
+      }
+      const Index * ve = vertEdge.Begin( e.v0 );
+      for( size_t i = 0; i < vertEdge.Count( e.v0 ); i++ ) {
+        if( edge[ ve[i] ].v1 == e.v1 ) {
+          return &edge[ ve[i] ];
+        }
+      }
+      return NULL;
+    }
+    size_t Bytes() const {
+      // map nodes carry about four pointers of tree links and color
+      size_t nodes = edgeMap.size() * ( sizeof( Edge ) + sizeof( size_t ) + 4 * sizeof( void * ) );
+      return faceVert.Bytes() + faceEdge.Bytes() + vertFace.Bytes() + vertEdge.Bytes() +
+             edge.capacity() * sizeof( Edge ) + nodes +
+             ( vertOrder.capacity() + twin.capacity() + cornerFace.capacity() + vertOut.capacity() ) * sizeof( Index );
+    }
+    void Release() {
+      ReleaseAdjacency();
+      faceVert.Release();
+      vector<Edge>().swap( edge );
+    }
+    // Drops all but faceVert and edge, what drawing needs. NumVerts() is
+    // 0 after it.
+    void ReleaseAdjacency() {
+      faceEdge.Release();
+      vertFace.Release();
+      vertEdge.Release();
+      vector<Index>().swap( vertOrder );
+      vector<Index>().swap( twin );
+      vector<Index>().swap( cornerFace );
+      vector<Index>().swap( vertOut );
+      edgeMap.clear();
+    }
+    void BuildEdgeMap() {
+      edgeMap.clear();
+      for( size_t i = 0; i < edge.size(); i++ ) {
+        edgeMap[ edge[i] ] = i;
+      }
+    }
+    // Materializes the old per-element vector form of the adjacency.
+    void BuildCompatView( vector<Vertex> & vert, vector<Face> & face ) const {
+      face.resize( NumFaces() );
+      for( size_t i = 0; i < face.size(); i++ ) {
+        face[i].vertIndex.assign( faceVert.Begin(i), faceVert.Begin(i) + faceVert.Count(i) );
+        face[i].edgeIndex.assign( faceEdge.Begin(i), faceEdge.Begin(i) + faceEdge.Count(i) );
+      }
+      vert.resize( NumVerts() );
+      for( size_t i = 0; i < vert.size(); i++ ) {
+        vert[i].faceIndex.assign( vertFace.Begin(i), vertFace.Begin(i) + vertFace.Count(i) );
+        vert[i].edgeIndex.assign( vertEdge.Begin(i), vertEdge.Begin(i) + vertEdge.Count(i) );
+      }
+    }
+  };
+  
+  // Compact copy of the positions and normals of a finished level, see
+  // quantize_level(). Positions are 16-bit fixed point within the bounding
+  // box of their patch of QuantPatch consecutive verts, normals octahedral
+  // maps in two 16-bit snorms. Both decode on the fly.
+  const size_t QuantPatch = 64;
+
+  struct QuantLevel {
+    QuantLevel() : posError( 0.0f ), nrmError( 0.0f ) {}
+    vector<uint16_t> pos;   // 3 per vert
+    vector<int16_t> nrm;    // 2 per vert
+    vector<Vec3f> base;     // per patch, box minimum
+    vector<Vec3f> step;     // per patch, box extent / 65535
+    float posError;         // largest coordinate error, measured
+    float nrmError;         // largest normal error in radians, measured
+    size_t Size() const {
+      return nrm.size() / 2;
+    }
+    Vec3f Position( size_t i ) const {
+      const uint16_t * q = &pos[ 3 * i ];
+      const Vec3f & b = base[ i / QuantPatch ];
+      const Vec3f & d = step[ i / QuantPatch ];
+      return Vec3f( b.x + d.x * q[0], b.y + d.y * q[1], b.z + d.z * q[2] );
+    }
+    Vec3f Normal( size_t i ) const {
+      float x = nrm[ 2 * i ] / 32767.0f, y = nrm[ 2 * i + 1 ] / 32767.0f;
+      float z = 1.0f - fabsf( x ) - fabsf( y );
+      if( z < 0.0f ) {
+        // lower hemisphere, folded over the diagonals
+        float fx = ( 1.0f - fabsf( y ) ) * ( x < 0.0f ? -1.0f : 1.0f );
+        y = ( 1.0f - fabsf( x ) ) * ( y < 0.0f ? -1.0f : 1.0f );
+        x = fx;
+      }
+      Vec3f n( x, y, z );
+      n.Normalize();
+      return n;
+    }
+    size_t Bytes() const {
+      return pos.capacity() * sizeof( uint16_t ) + nrm.capacity() * sizeof( int16_t ) +
+             ( base.capacity() + step.capacity() ) * sizeof( Vec3f );
+    }
+    void Release() {
+      vector<uint16_t>().swap( pos );
+      vector<int16_t>().swap( nrm );
+      vector<Vec3f>().swap( base );
+      vector<Vec3f>().swap( step );
+      posError = nrmError = 0.0f;
+    }
+  };
+
+  struct Model {
+    Model() : prev(NULL), next(NULL), level(0), evicted(false), quantized(false), lastUse(0), stamp(0) {}
+    ~Model() {
+      if( next != 0 ) {
+        delete next;
+      }
+    }
+    vector<Vec3f> vpos;
+    Vec3fSoa spos;     // vpos as a structure of arrays, written by average()
+    vector<Vec3f> vnrm;
+    vector<Vec3f> fnrm;  // scaled by twice the face area
+    Topo topo;
+    Model *prev;
+    Model *next;
+    size_t level;
+    bool evicted;      // data dropped by the level cache, see touch_level()
+    bool quantized;    // vpos and vnrm held in quant, see quantize_level()
+    QuantLevel quant;
+    size_t lastUse;
+    size_t stamp;      // of the last vpos / vnrm update
+  };
+  
+  
+  //
+
+  // Area-weighted normals of faces [begin,end): the sum of the fan
+  // triangle cross products, which for a quad is the cross product of its
+  // diagonals. All-quad ranges run SUBDIV_SIMD faces at a time.
+  void face_normals( Model & m, size_t begin, size_t end ) {
+    const Topo & t = m.topo;
+    size_t i = begin;
+#if SUBDIV_SIMD
+    bool quads = end > begin;
+    for( size_t j = begin; j <= end; j++ ) {
+      quads = quads && t.faceVert.offset[j] == 4 * j;
+    }
+    if( quads ) {
+      const Index * fv = t.faceVert.Begin( 0 );
+      const Vec3f * p = &m.vpos[0];
+      for( ; i + SUBDIV_SIMD <= end; i += SUBDIV_SIMD ) {
+        vfloat x[4], y[4], z[4];
+        for( size_t j = 0; j < 4; j++ ) {
+          Index lane[ SUBDIV_SIMD ];
+          for( size_t k = 0; k < SUBDIV_SIMD; k++ ) {
+            lane[k] = fv[ 4 * ( i + k ) + j ];
+          }
+          vgather3( p, lane, x[j], y[j], z[j] );
+        }
+        vfloat ax = vsub( x[2], x[0] ), ay = vsub( y[2], y[0] ), az = vsub( z[2], z[0] );
+        vfloat bx = vsub( x[3], x[1] ), by = vsub( y[3], y[1] ), bz = vsub( z[3], z[1] );
+        vscatter3( &m.fnrm[0], i,
+                   vsub( vmul( ay, bz ), vmul( az, by ) ),
+                   vsub( vmul( az, bx ), vmul( ax, bz ) ),
+                   vsub( vmul( ax, by ), vmul( ay, bx ) ) );
+      }
+    }
+#endif
+    for( ; i < end; i++ ) {
+      const Index * fv = t.faceVert.Begin(i);
+      size_t fc = t.faceVert.Count(i);
+      const Vec3f & v0 = m.vpos[ fv[0] ];
+      Vec3f n(0,0,0);
+      if( fc == 4 ) {
+        // the diagonals, as in the simd path, so a quad gets the same
+        // normal whichever path it takes
+        n = ( m.vpos[ fv[2] ] - v0 ).Cross( m.vpos[ fv[3] ] - m.vpos[ fv[1] ] );
+      } else {
+        for( size_t j = 1; j < fc - 1; j++ ) {
+          n += ( m.vpos[ fv[j] ] - v0 ).Cross( m.vpos[ fv[j+1] ] - v0 );
+        }
+      }
+      m.fnrm[ i ] = n;
+    }
+  }
+
+  // Normals of verts [begin,end), the normalized sum of the area-weighted
+  // normals of their faces gathered through vertFace. The simd path sums
+  // SUBDIV_SIMD face lists into lanes and normalizes them together. A short
+  // last group runs padded with zero lanes, so a vert gets the same normal
+  // whichever thread's range it falls in.
+  void vertex_normals( Model & m, size_t begin, size_t end ) {
+    const Topo & t = m.topo;
+    size_t i = begin;
+#if SUBDIV_SIMD
+    for( ; i < end; i += SUBDIV_SIMD ) {
+      size_t lanes = std::min( end - i, size_t( SUBDIV_SIMD ) );
+      float sx[ SUBDIV_SIMD ], sy[ SUBDIV_SIMD ], sz[ SUBDIV_SIMD ];
+      for( size_t k = lanes; k < SUBDIV_SIMD; k++ ) {
+        sx[k] = sy[k] = sz[k] = 0.0f;
+      }
+      for( size_t k = 0; k < lanes; k++ ) {
+        const Index * vf = t.vertFace.Begin( i + k );
+        size_t faces = t.vertFace.Count( i + k );
+        Vec3f n(0,0,0);
+        for( size_t j = 0; j < faces; j++ ) {
+          n += m.fnrm[ vf[ j ] ];
+        }
+        sx[k] = n.x;
+        sy[k] = n.y;
+        sz[k] = n.z;
+      }
+      vfloat x = vload( sx ), y = vload( sy ), z = vload( sz );
+      vnormalize( x, y, z );
+      if( lanes == SUBDIV_SIMD ) {
+        vscatter3( &m.vnrm[0], i, x, y, z );
+        continue;
+      }
+      vstore( sx, x );
+      vstore( sy, y );
+      vstore( sz, z );
+      for( size_t k = 0; k < lanes; k++ ) {
+        m.vnrm[ i + k ] = Vec3f( sx[k], sy[k], sz[k] );
+      }
+    }
+    i = end;
+#endif
+    for( ; i < end; i++ ) {
+      const Index * vf = t.vertFace.Begin(i);
+      size_t faces = t.vertFace.Count(i);
+      Vec3f n(0,0,0);
+      for( size_t j = 0; j < faces; j++ ) {
+        n += m.fnrm[ vf[ j ] ];
+      }
+      float d = n.Dot( n );
+      m.vnrm[ i ] = d > 0.0f ? n / sqrtf( d ) : n;
+    }
+  }
+
+  // parallel_for bodies for the per-phase kernels
+  struct FaceNormals {
+    Model * m;
+    void operator()( size_t begin, size_t end, size_t ) { face_normals( *m, begin, end ); }
+  };
+
+  struct VertexNormals {
+    Model * m;
+    void operator()( size_t begin, size_t end, size_t ) { vertex_normals( *m, begin, end ); }
+  };
+
+  // Both passes split across worker_threads(), the join between them is
+  // the barrier the vertex pass needs on the face normals.
+  void compute_normals( Model & m ) {
+    size_t threads = worker_threads();
+    m.fnrm.resize( m.topo.NumFaces() );
+    FaceNormals fn = { &m };
+    parallel_for( m.fnrm.size(), threads, fn );
+    
+    m.vnrm.resize( m.vpos.size() );
+    VertexNormals vn = { &m };
+    parallel_for( m.vnrm.size(), threads, vn );
+    m.stamp = next_stamp();
+  }
+
+  
+  // Face points of faces [begin,end) go to r[ base + face ]. All-quad ranges
+  // run SUBDIV_SIMD faces at a time, anything else takes the scalar loop.
+  void average_face_points( const Topo & pt, const Vec3fSoa & p, Vec3fSoa & r, size_t base, size_t begin, size_t end ) {
+    size_t i = begin;
+#if SUBDIV_SIMD
+    bool quads = end > begin;
+    for( size_t j = begin; j <= end; j++ ) {
+      quads = quads && pt.faceVert.offset[j] == 4 * j;
+    }
+    if( quads ) {
+      const Index * fv = pt.faceVert.Begin( 0 );
+      vfloat four = vset1( 4.0f );
+      for( ; i + SUBDIV_SIMD <= end; i += SUBDIV_SIMD ) {
+        vfloat x = vset1( 0.0f ), y = x, z = x;
+        for( size_t j = 0; j < 4; j++ ) {
+          Index lane[ SUBDIV_SIMD ];
+          for( size_t k = 0; k < SUBDIV_SIMD; k++ ) {
+            lane[k] = fv[ 4 * ( i + k ) + j ];
+          }
+          x = vadd( x, vgather( &p.x[0], lane ) );
+          y = vadd( y, vgather( &p.y[0], lane ) );
+          z = vadd( z, vgather( &p.z[0], lane ) );
+        }
+        vstore( &r.x[ base + i ], vdiv( x, four ) );
+        vstore( &r.y[ base + i ], vdiv( y, four ) );
+        vstore( &r.z[ base + i ], vdiv( z, four ) );
+      }
+    }
+#endif
+    for( ; i < end; i++ ) {
+      const Index * f = pt.faceVert.Begin(i);
+      size_t fv = pt.faceVert.Count(i);
+      float x = 0, y = 0, z = 0;
+      for( size_t j = 0; j < fv; j++ ) {
+        x += p.x[ f[j] ];
+        y += p.y[ f[j] ];
+        z += p.z[ f[j] ];
+      }
+      r.x[ base + i ] = x / float( fv );
+      r.y[ base + i ] = y / float( fv );
+      r.z[ base + i ] = z / float( fv );
+    }
+  }
+
+  // Edge points of edges [begin,end) go to r[ base + edge ], reading face
+  // points from r[ fbase + face ].
+  // Adjacent face points are weighted by a 0/1 mask instead of branching on
+  // crease and boundary; a missing face reads face 0 with weight 0.
+  void average_edge_points( const Topo & pt, const Vec3fSoa & p, Vec3fSoa & r, size_t fbase, size_t base, size_t begin, size_t end ) {
+    size_t i = begin;
+#if SUBDIV_SIMD
+    vfloat zero = vset1( 0.0f ), one = vset1( 1.0f ), two = vset1( 2.0f );
+    for( ; i + SUBDIV_SIMD <= end; i += SUBDIV_SIMD ) {
+      Index v0[ SUBDIV_SIMD ], v1[ SUBDIV_SIMD ], f0[ SUBDIV_SIMD ], f1[ SUBDIV_SIMD ];
+      float has0[ SUBDIV_SIMD ], has1[ SUBDIV_SIMD ], crease[ SUBDIV_SIMD ];
+      for( size_t k = 0; k < SUBDIV_SIMD; k++ ) {
+        const Edge & e = pt.edge[ i + k ];
+        v0[k] = e.v0;
+        v1[k] = e.v1;
+        has0[k] = float( e.f0 != InvalidIndex );
+        has1[k] = float( e.f1 != InvalidIndex );
+        f0[k] = Index( fbase + ( e.f0 & ( Index( 0 ) - Index( e.f0 != InvalidIndex ) ) ) );
+        f1[k] = Index( fbase + ( e.f1 & ( Index( 0 ) - Index( e.f1 != InvalidIndex ) ) ) );
+        crease[k] = e.crease;
+      }
+      vfloat smooth = vand( vcmpeq( vload( crease ), zero ), one );
+      vfloat w0 = vmul( smooth, vload( has0 ) );
+      vfloat w1 = vmul( smooth, vload( has1 ) );
+      vfloat count = vadd( vadd( two, w0 ), w1 );
+      vfloat x = vadd( vgather( &p.x[0], v0 ), vgather( &p.x[0], v1 ) );
+      vfloat y = vadd( vgather( &p.y[0], v0 ), vgather( &p.y[0], v1 ) );
+      vfloat z = vadd( vgather( &p.z[0], v0 ), vgather( &p.z[0], v1 ) );
+      x = vadd( vadd( x, vmul( w0, vgather( &r.x[0], f0 ) ) ), vmul( w1, vgather( &r.x[0], f1 ) ) );
+      y = vadd( vadd( y, vmul( w0, vgather( &r.y[0], f0 ) ) ), vmul( w1, vgather( &r.y[0], f1 ) ) );
+      z = vadd( vadd( z, vmul( w0, vgather( &r.z[0], f0 ) ) ), vmul( w1, vgather( &r.z[0], f1 ) ) );
+      vstore( &r.x[ base + i ], vdiv( x, count ) );
+      vstore( &r.y[ base + i ], vdiv( y, count ) );
+      vstore( &r.z[ base + i ], vdiv( z, count ) );
+    }
+#endif
+    for( ; i < end; i++ ) {
+      const Edge & e = pt.edge[ i ];
+      float smooth = float( e.crease == 0.0f );
+      float w0 = smooth * float( e.f0 != InvalidIndex );
+      float w1 = smooth * float( e.f1 != InvalidIndex );
+      size_t f0 = fbase + ( e.f0 & ( Index( 0 ) - Index( e.f0 != InvalidIndex ) ) );
+      size_t f1 = fbase + ( e.f1 & ( Index( 0 ) - Index( e.f1 != InvalidIndex ) ) );
+      float count = 2.0f + w0 + w1;
+      r.x[ base + i ] = ( p.x[ e.v0 ] + p.x[ e.v1 ] + w0 * r.x[ f0 ] + w1 * r.x[ f1 ] ) / count;
+      r.y[ base + i ] = ( p.y[ e.v0 ] + p.y[ e.v1 ] + w0 * r.y[ f0 ] + w1 * r.y[ f1 ] ) / count;
+      r.z[ base + i ] = ( p.z[ e.v0 ] + p.z[ e.v1 ] + w0 * r.z[ f0 ] + w1 * r.z[ f1 ] ) / count;
+    }
+  }
+
+  // Vertex points of verts [begin,end) go to r[ vertex ], reading face points
+  // from r[ fbase + face ].
+  // The simd path walks SUBDIV_SIMD one-rings in lockstep up to the largest
+  // valence of the group, masking off lanes whose ring has run out. Verts
+  // on no edge stay put, as creased ones do.
+  void average_vertex_points( const Topo & pt, const Vec3fSoa & p, Vec3fSoa & r, size_t fbase, size_t begin, size_t end ) {
+    size_t i = begin;
+#if SUBDIV_SIMD
+    vfloat zero = vset1( 0.0f ), half = vset1( 0.5f ), two = vset1( 2.0f ), three = vset1( 3.0f );
+    for( ; i + SUBDIV_SIMD <= end; i += SUBDIV_SIMD ) {
+      float valence[ SUBDIV_SIMD ], faces[ SUBDIV_SIMD ], lone[ SUBDIV_SIMD ];
+      size_t maxe = 0, maxf = 0;
+      for( size_t k = 0; k < SUBDIV_SIMD; k++ ) {
+        valence[k] = float( pt.vertEdge.Count( i + k ) );
+        lone[k] = float( pt.vertEdge.Count( i + k ) == 0 );
+        faces[k] = float( pt.vertFace.Count( i + k ) );
+        maxe = max( maxe, pt.vertEdge.Count( i + k ) );
+        maxf = max( maxf, pt.vertFace.Count( i + k ) );
+      }
+      vfloat rx = zero, ry = zero, rz = zero, crease = vload( lone );
+      for( size_t j = 0; j < maxe; j++ ) {
+        Index v0[ SUBDIV_SIMD ], v1[ SUBDIV_SIMD ];
+        float live[ SUBDIV_SIMD ], cr[ SUBDIV_SIMD ];
+        for( size_t k = 0; k < SUBDIV_SIMD; k++ ) {
+          bool on = j < pt.vertEdge.Count( i + k );
+          const Edge & e = pt.edge[ on ? pt.vertEdge.Begin( i + k )[j] : 0 ];
+          v0[k] = e.v0;
+          v1[k] = e.v1;
+          live[k] = float( on );
+          cr[k] = on ? e.crease : 0.0f;
+        }
+        vfloat w = vmul( vload( live ), half );
+        rx = vadd( rx, vmul( w, vadd( vgather( &p.x[0], v0 ), vgather( &p.x[0], v1 ) ) ) );
+        ry = vadd( ry, vmul( w, vadd( vgather( &p.y[0], v0 ), vgather( &p.y[0], v1 ) ) ) );
+        rz = vadd( rz, vmul( w, vadd( vgather( &p.z[0], v0 ), vgather( &p.z[0], v1 ) ) ) );
+        crease = vmax( crease, vload( cr ) );
+      }
+      vfloat fx = zero, fy = zero, fz = zero;
+      for( size_t j = 0; j < maxf; j++ ) {
+        Index f[ SUBDIV_SIMD ];
+        float live[ SUBDIV_SIMD ];
+        for( size_t k = 0; k < SUBDIV_SIMD; k++ ) {
+          bool on = j < pt.vertFace.Count( i + k );
+          f[k] = Index( fbase + ( on ? pt.vertFace.Begin( i + k )[j] : 0 ) );
+          live[k] = float( on );
+        }
+        vfloat w = vload( live );
+        fx = vadd( fx, vmul( w, vgather( &r.x[0], f ) ) );
+        fy = vadd( fy, vmul( w, vgather( &r.y[0], f ) ) );
+        fz = vadd( fz, vmul( w, vgather( &r.z[0], f ) ) );
+      }
+      vfloat n = vload( valence );
+      vfloat nf = vload( faces );
+      vfloat k3 = vsub( n, three );
+      vfloat creased = vcmpgt( crease, zero );
+      vfloat x = vload( &p.x[i] ), y = vload( &p.y[i] ), z = vload( &p.z[i] );
+      vfloat sx = vdiv( vadd( vadd( vdiv( fx, nf ), vmul( vdiv( rx, n ), two ) ), vmul( x, k3 ) ), n );
+      vfloat sy = vdiv( vadd( vadd( vdiv( fy, nf ), vmul( vdiv( ry, n ), two ) ), vmul( y, k3 ) ), n );
+      vfloat sz = vdiv( vadd( vadd( vdiv( fz, nf ), vmul( vdiv( rz, n ), two ) ), vmul( z, k3 ) ), n );
+      vstore( &r.x[i], vselect( creased, x, sx ) );
+      vstore( &r.y[i], vselect( creased, y, sy ) );
+      vstore( &r.z[i], vselect( creased, z, sz ) );
+    }
+#endif
+    for( ; i < end; i++ ) {
+      const Index * ve = pt.vertEdge.Begin(i);
+      const Index * vf = pt.vertFace.Begin(i);
+      size_t valence = pt.vertEdge.Count(i);
+      size_t faces = pt.vertFace.Count(i);
+      Vec3f fp(0, 0, 0);
+      Vec3f rp(0, 0, 0);
+      bool creased = valence == 0;
+      for( size_t j = 0; j < valence; j++ ) {
+        const Edge & e = pt.edge[ ve[j] ];
+        rp += ( p.Get( e.v0 ) + p.Get( e.v1 ) ) / 2.0f;
+        if( e.crease > 0.0f ) {
+          creased = true;
+        }
+      }
+      if( ! creased ) {
+        rp /= valence;
+        for( size_t j = 0; j < faces; j++ ) {
+          fp += r.Get( fbase + vf[j] );
+        }
+        fp /= faces;
+        Vec3f q = fp + rp * 2.0f + p.Get( i ) * ( float( valence ) - 3.0f );
+        q /= valence;
+        r.Set( i, q );
+      } else {
+        r.Set( i, p.Get( i ) );
+      }
+    }
+  }
+
+  struct AverageFaces {
+    const Topo * pt;
+    const Vec3fSoa * p;
+    Vec3fSoa * r;
+    size_t base;
+    void operator()( size_t begin, size_t end, size_t ) {
+      average_face_points( *pt, *p, *r, base, begin, end );
+    }
+  };
+
+  struct AverageEdges {
+    const Topo * pt;
+    const Vec3fSoa * p;
+    Vec3fSoa * r;
+    size_t fbase, base;
+    void operator()( size_t begin, size_t end, size_t ) {
+      average_edge_points( *pt, *p, *r, fbase, base, begin, end );
+    }
+  };
+
+  struct AverageVerts {
+    const Topo * pt;
+    const Vec3fSoa * p;
+    Vec3fSoa * r;
+    size_t fbase;
+    void operator()( size_t begin, size_t end, size_t ) {
+      average_vertex_points( *pt, *p, *r, fbase, begin, end );
+    }
+  };
+
+  struct ScatterVerts {
+    const Index * order;
+    const Vec3fSoa * p;
+    Vec3fSoa * r;
+    void operator()( size_t begin, size_t end, size_t ) {
+      for( size_t i = begin; i < end; i++ ) {
+        r->x[ order[i] ] = p->x[i];
+        r->y[ order[i] ] = p->y[i];
+        r->z[ order[i] ] = p->z[i];
+      }
+    }
+  };
+
+  // Positions are averaged on the Vec3fSoa copies and then copied back to
+  // vpos. The cage is edited through vpos, so its spos is refreshed here.
+  // Each phase is split across worker_threads() and joined before the
+  // next, since edge and vertex points read the face points.
+  void average( Model & m ) {
+    if( m.prev == NULL ) {
+      return;
+    }
+    Model & prev = *m.prev;
+    const Topo & pt = prev.topo;
+    size_t pv = pt.NumVerts(); // previous verts
+    size_t pf = pt.NumFaces(); // previous faces
+
+    if( prev.prev == NULL || prev.spos.Size() != prev.vpos.size() ) {
+      to_soa( prev.vpos, prev.spos );
+    }
+    m.spos.Resize( m.topo.NumVerts() );
+    
+    size_t threads = worker_threads();
+    
+    // per-face verts
+    AverageFaces af = { &pt, &prev.spos, &m.spos, pv };
+    parallel_for( pf, threads, af );
+
+    // per-edge verts
+    AverageEdges ae = { &pt, &prev.spos, &m.spos, pv, pv + pf };
+    parallel_for( pt.edge.size(), threads, ae );
+    
+    // original verts
+    AverageVerts av = { &pt, &prev.spos, &m.spos, pv };
+    parallel_for( pv, threads, av );
+
+    // from split slots to the reordered verts
+    const vector<Index> & order = m.topo.vertOrder;
+    if( ! order.empty() ) {
+      Vec3fSoa r;
+      r.Resize( order.size() );
+      ScatterVerts sv = { &order[0], &m.spos, &r };
+      parallel_for( order.size(), threads, sv );
+      m.spos.x.swap( r.x );
+      m.spos.y.swap( r.y );
+      m.spos.z.swap( r.z );
+    }
+    to_aos( m.spos, m.vpos );
+  }
+
+  // Half-edges
+  //
+  // The corners of faceVert double as half-edges: corner h of face f runs
+  // from faceVert.index[h] to the next corner of f, found by Next(). twin
+  // is the corner running the other way along the same edge, InvalidIndex
+  // on a boundary, cornerFace the face of each corner, left empty when all
+  // faces are quads and corner h is corner h % 4 of face h / 4, and vertOut
+  // a corner leaving each vert. For interior verts that is their corner in their
+  // first vertFace face, for boundary verts the first one in face order,
+  // so twin[ Prev( h ) ] steps around a ring in order from it.
+  // build_half_edges() fills them in O( corners ) from the edges. With
+  // halfEdges set, split_topo() and limit_project() keep them on every
+  // level and limit_ring() walks them instead of searching vertEdge. It is
+  // off by default: the crease check already pulls the ring's edges into
+  // cache, so the walk mostly adds the twin array to the traffic.
+  bool halfEdges = false;
+
+  size_t corner_of( const Topo & t, size_t f, Index u ) {
+    const Index * q = t.faceVert.Begin(f);
+    size_t j = 0;
+    while( q[j] != u ) {
+      j++;
+    }
+    return j;
+  }
+
+  struct HalfEdgeFaces {
+    Topo * t;
+    void operator()( size_t begin, size_t end, size_t ) {
+      for( size_t i = begin; i < end; i++ ) {
+        for( size_t h = t->faceVert.offset[i]; h < t->faceVert.offset[ i + 1 ]; h++ ) {
+          t->cornerFace[h] = Index( i );
+        }
+      }
+    }
+  };
+
+  struct HalfEdgeTwins {
+    Topo * t;
+    void operator()( size_t begin, size_t end, size_t ) {
+      for( size_t i = begin; i < end; i++ ) {
+        const Index * fe = t->faceEdge.Begin(i);
+        size_t base = t->faceVert.offset[i];
+        for( size_t j = 0; j < t->faceEdge.Count(i); j++ ) {
+          const Edge & e = t->edge[ fe[j] ];
+          Index g = e.f0 == i ? e.f1 : e.f0;
+          Index twin = InvalidIndex;
+          if( g != InvalidIndex ) {
+            // the other corner of g on this edge, a face may use it twice
+            const Index * ge = t->faceEdge.Begin(g);
+            for( size_t k = 0; k < t->faceEdge.Count(g); k++ ) {
+              if( ge[k] == fe[j] && t->faceEdge.offset[g] + k != base + j ) {
+                twin = Index( t->faceEdge.offset[g] + k );
+              }
+            }
+          }
+          t->twin[ base + j ] = twin;
+        }
+      }
+    }
+  };
+
+  struct HalfEdgeVerts {
+    Topo * t;
+    void operator()( size_t begin, size_t end, size_t ) {
+      for( size_t v = begin; v < end; v++ ) {
+        const Index * vf = t->vertFace.Begin(v);
+        Index out = InvalidIndex;
+        for( size_t j = 0; j < t->vertFace.Count(v); j++ ) {
+          Index h = Index( t->faceVert.offset[ vf[j] ] + corner_of( *t, vf[j], Index( v ) ) );
+          if( out == InvalidIndex ) {
+            out = h;
+          }
+          if( t->twin[ t->Prev(h) ] == InvalidIndex ) {
+            out = h;
+            break;
+          }
+        }
+        t->vertOut[v] = out;
+      }
+    }
+  };
+
+  void build_half_edges( Topo & t ) {
+    size_t threads = worker_threads();
+    bool quads = true;
+    for( size_t i = 0; quads && i <= t.NumFaces(); i++ ) {
+      quads = t.faceVert.offset[i] == 4 * i;
+    }
+    t.cornerFace.clear();
+    if( ! quads ) {
+      t.cornerFace.resize( t.faceVert.index.size() );
+      HalfEdgeFaces hf = { &t };
+      parallel_for( t.NumFaces(), threads, hf );
+    }
+    t.twin.resize( t.faceVert.index.size() );
+    t.vertOut.resize( t.NumVerts() );
+    HalfEdgeTwins ht = { &t };
+    parallel_for( t.NumFaces(), threads, ht );
+    HalfEdgeVerts hv = { &t };
+    parallel_for( t.NumVerts(), threads, hv );
+  }
+
+  // Limit surface
+  //
+  // Refined levels are all quads, so a smooth interior vertex of valence n
+  // with ring points e[i] and diagonal points f[i] in face order has the
+  // Catmull-Clark limit position ( n^2 v + 4 sum e + sum f ) / ( n ( n + 5 ) )
+  // and a limit normal from the cross product of the two tangent masks
+  //   t0 = sum A cos( 2 pi i / n ) e[i] + ( cos( 2 pi i / n ) + cos( 2 pi ( i + 1 ) / n ) ) f[i]
+  //   t1 = the same with sin, where A = 1 + cos( 2 pi / n ) + cos( pi / n ) sqrt( 2 ( 9 + cos( 2 pi / n ) ) ).
+  // Vertices on a boundary or a crease, or of a valence over MaxLimitValence,
+  // keep their refined position and fan normal.
+
+  bool limitSurface = false;
+  const size_t MaxLimitValence = 32;
+
+  // Tangent mask weights per valence: e weights at [ 2 * i ], f weights at
+  // [ 2 * i + 1 ], cos in mask0 and sin in mask1.
+  struct LimitMasks {
+    vector<float> mask0[ MaxLimitValence + 1 ];
+    vector<float> mask1[ MaxLimitValence + 1 ];
+    LimitMasks() {
+      for( size_t n = 3; n <= MaxLimitValence; n++ ) {
+        double a = 2.0 * M_PI / n;
+        double an = 1.0 + cos( a ) + cos( a / 2.0 ) * sqrt( 2.0 * ( 9.0 + cos( a ) ) );
+        mask0[n].resize( 2 * n );
+        mask1[n].resize( 2 * n );
+        for( size_t i = 0; i < n; i++ ) {
+          mask0[n][ 2 * i + 0 ] = float( an * cos( a * i ) );
+          mask0[n][ 2 * i + 1 ] = float( cos( a * i ) + cos( a * ( i + 1 ) ) );
+          mask1[n][ 2 * i + 0 ] = float( an * sin( a * i ) );
+          mask1[n][ 2 * i + 1 ] = float( sin( a * i ) + sin( a * ( i + 1 ) ) );
+        }
+      }
+    }
+  };
+
+  // Walks the one-ring of v in face order, false when v is not a smooth
+  // interior vertex surrounded by quads.
+  bool limit_ring( const Topo & t, Index v, Index * e, Index * f, size_t & n ) {
+    n = t.vertEdge.Count(v);
+    if( n < 3 || n > MaxLimitValence || t.vertFace.Count(v) != n ) {
+      return false;
+    }
+    const Index * ve = t.vertEdge.Begin(v);
+    for( size_t j = 0; j < n; j++ ) {
+      if( t.edge[ ve[j] ].crease > 0.0f ) {
+        return false;
+      }
+    }
+    if( t.HasHalfEdges() ) {
+      Index h = t.vertOut[v];
+      for( size_t i = 0; i < n; i++ ) {
+        if( h == InvalidIndex || t.faceVert.Count( t.CornerFace(h) ) != 4 ) {
+          return false;
+        }
+        Index h1 = t.Next(h), h2 = t.Next( h1 );
+        e[i] = t.faceVert.index[ h1 ];
+        f[i] = t.faceVert.index[ h2 ];
+        h = t.twin[ t.Prev(h) ];
+      }
+      return h == t.vertOut[v];
+    }
+    size_t face = t.vertFace.Begin(v)[0];
+    for( size_t i = 0; i < n; i++ ) {
+      if( face == InvalidIndex || t.faceVert.Count( face ) != 4 ) {
+        return false;
+      }
+      const Index * q = t.faceVert.Begin( face );
+      size_t k = corner_of( t, face, v );
+      e[i] = q[ ( k + 1 ) % 4 ];
+      f[i] = q[ ( k + 2 ) % 4 ];
+      // the next face shares the edge from v to q[ k + 3 ]
+      Index next = q[ ( k + 3 ) % 4 ];
+      size_t nf = InvalidIndex;
+      for( size_t j = 0; j < n; j++ ) {
+        const Edge & ed = t.edge[ ve[j] ];
+        if( ed.v0 == next || ed.v1 == next ) {
+          nf = ed.f0 == face ? ed.f1 : ed.f0;
+        }
+      }
+      face = nf;
+    }
+    return face == t.vertFace.Begin(v)[0];
+  }
+
+  // Limit positions and normals of verts [begin,end) from the control
+  // points m.spos. Face normals must already be in m.fnrm for the fallback.
+  struct LimitVerts {
+    Model * m;
+    const LimitMasks * masks;
+    void operator()( size_t begin, size_t end, size_t ) {
+      const Topo & t = m->topo;
+      const Vec3fSoa & p = m->spos;
+      Index e[ MaxLimitValence ], f[ MaxLimitValence ];
+      for( size_t v = begin; v < end; v++ ) {
+        size_t n;
+        if( ! limit_ring( t, Index( v ), e, f, n ) ) {
+          vertex_normals( *m, v, v + 1 );
+          continue;
+        }
+        const float * w0 = &masks->mask0[n][0];
+        const float * w1 = &masks->mask1[n][0];
+        Vec3f pos = p.Get( v ) * float( n * n );
+        Vec3f t0( 0, 0, 0 ), t1( 0, 0, 0 );
+        for( size_t i = 0; i < n; i++ ) {
+          Vec3f pe = p.Get( e[i] ), pf = p.Get( f[i] );
+          pos += pe * 4.0f + pf;
+          t0 += pe * w0[ 2 * i ] + pf * w0[ 2 * i + 1 ];
+          t1 += pe * w1[ 2 * i ] + pf * w1[ 2 * i + 1 ];
+        }
+        Vec3f nrm = t0.Cross( t1 );
+        nrm.Normalize();
+        m->vpos[v] = pos / float( n * ( n + 5 ) );
+        m->vnrm[v] = nrm;
+      }
+    }
+  };
+
+  // Moves the vertices of a refined level onto the limit surface and sets
+  // their limit normals. Control points stay in m.spos for the next level.
+  const LimitMasks & limit_masks() {
+    static const LimitMasks masks;
+    return masks;
+  }
+
+  void limit_project( Model & m ) {
+    const LimitMasks & masks = limit_masks();
+    size_t threads = worker_threads();
+    if( halfEdges && ! m.topo.HasHalfEdges() ) {
+      build_half_edges( m.topo );
+    }
+    if( m.spos.Size() != m.vpos.size() ) {
+      to_soa( m.vpos, m.spos );
+    }
+    m.fnrm.resize( m.topo.NumFaces() );
+    FaceNormals fn = { &m };
+    parallel_for( m.fnrm.size(), threads, fn );
+    m.vnrm.resize( m.vpos.size() );
+    LimitVerts lv = { &m, &masks };
+    parallel_for( m.vpos.size(), threads, lv );
+    m.stamp = next_stamp();
+  }
+
+  // Normals of a freshly averaged level, plus limit positions for refined
+  // levels when limitSurface is set.
+  void finish_level( Model & m ) {
+    if( limitSurface && m.prev != NULL ) {
+      limit_project( m );
+    } else {
+      compute_normals( m );
+    }
+  }
+
+  // Also flags, per chunk, faces of fewer than 3 verts, with a vert out of
+  // range or with a vert twice.
+  struct EdgeKeyFill {
+    const Topo * t;
+    uint64_t nv;
+    uint64_t verts;
+    KeyIndex * hk;
+    char * bad;
+    void operator()( size_t begin, size_t end, size_t c ) {
+      for( size_t i = begin; i < end; i++ ) {
+        const Index * f = t->faceVert.Begin(i);
+        size_t fv = t->faceVert.Count(i);
+        size_t base = t->faceVert.offset[i];
+        if( fv < 3 ) {
+          bad[c] = 1;
+        }
+        for( size_t j = 0; j < fv; j++ ) {
+          if( f[j] >= verts || std::find( f + j + 1, f + fv, f[j] ) != f + fv ) {
+            bad[c] = 1;
+            return;
+          }
+        }
+        for( size_t j = 0; j < fv; j++ ) {
+          uint64_t j0 = f[ j ];
+          uint64_t j1 = f[ ( j + 1 ) % fv ];
+          KeyIndex & k = hk[ base + j ];
+          // nv == 0 asks for the v1 half of an unpacked key
+          k.key = j0 < j1 ? j0 * nv + j1 : j1 * nv + j0;
+          k.index = base + j;
+        }
+      }
+    }
+  };
+
+  // Counts runs of equal keys, and flags edges of more than two faces or
+  // of two faces that run along it the same way, which a manifold,
+  // consistently oriented mesh does not have.
+  struct EdgeRunCount {
+    const Topo * t;
+    const KeyIndex * hk;
+    const Index * cornerFace;
+    size_t * runs;     // per chunk
+    char * bad;
+    // whether corner c's edge runs from its lower vert
+    bool Forward( size_t c ) const {
+      size_t fi = cornerFace[c];
+      const Index * f = t->faceVert.Begin( fi );
+      size_t j = c - t->faceVert.offset[ fi ];
+      return f[j] < f[ ( j + 1 ) % t->faceVert.Count( fi ) ];
+    }
+    void operator()( size_t begin, size_t end, size_t ch ) {
+      size_t c = 0;
+      for( size_t i = begin; i < end; i++ ) {
+        if( i == 0 || hk[i].key != hk[i-1].key ) {
+          c++;
+        } else if( ( i > 1 && hk[i].key == hk[i-2].key ) ||
+                   Forward( hk[i].index ) == Forward( hk[ i - 1 ].index ) ) {
+          bad[ch] = 1;
+        }
+      }
+      runs[ch] = c;
+    }
+  };
+
+  // Each half-edge writes only its own side ( f0 or f1 ) of the shared edge,
+  // and only the first of a run writes v0/v1, so chunks never collide.
+  struct EdgeAssign {
+    Topo * t;
+    const KeyIndex * hk;
+    const size_t * runs;    // exclusive prefix per chunk
+    const Index * cornerFace;
+    void operator()( size_t begin, size_t end, size_t c ) {
+      size_t eidx = runs[c] - 1;
+      for( size_t i = begin; i < end; i++ ) {
+        bool head = ( i == 0 || hk[i].key != hk[i-1].key );
+        eidx += head ? 1 : 0;
+        size_t corner = hk[i].index;
+        size_t fi = cornerFace[ corner ];
+        const Index * f = t->faceVert.Begin( fi );
+        size_t j = corner - t->faceVert.offset[ fi ];
+        Index j0 = f[ j ];
+        Index j1 = f[ ( j + 1 ) % t->faceVert.Count( fi ) ];
+        Edge & e = t->edge[ eidx ];
+        if( head ) {
+          e.v0 = min( j0, j1 );
+          e.v1 = max( j0, j1 );
+        }
+        e.AddFace( j0, j1, fi );
+        t->faceEdge.index[ corner ] = eidx;
+      }
+    }
+  };
+
+  // The vertex adjacency is the transpose of the face and edge adjacency.
+  void derive_vert_adjacency( Topo & t, size_t nv ) {
+    size_t edges = t.edge.size();
+    transpose_csr( t.faceVert, nv, t.vertFace );
+    Csr edgeVert;
+    edgeVert.offset.resize( edges + 1 );
+    edgeVert.index.resize( edges * 2 );
+    for( size_t i = 0; i < edges; i++ ) {
+      edgeVert.offset[ i + 1 ] = 2 * ( i + 1 );
+      edgeVert.index[ 2 * i + 0 ] = t.edge[i].v0;
+      edgeVert.index[ 2 * i + 1 ] = t.edge[i].v1;
+    }
+    transpose_csr( edgeVert, nv, t.vertEdge );
+    t.stamp = next_stamp();
+  }
+
+  // Builds edges by sorting packed ( v0, v1 ) keys of every half-edge, so
+  // matching half-edges end up adjacent and no map lookups are needed.
+  // The vertex adjacency, over verts verts, is then the transpose of the
+  // face adjacency. Returns false, leaving t without edges, for a face of
+  // fewer than 3 verts, a vert twice or out of range, or an edge that is
+  // not manifold, see EdgeRunCount.
+  bool derive_topo_from_face_verts( Topo & t, size_t verts, bool buildEdgeMap = false ) {
+    size_t nf = t.NumFaces();
+    size_t threads = worker_threads();
+    size_t corners = t.faceVert.index.size();
+    t.edge.clear();
+    vector<Index> cornerFace( corners );
+    for( size_t i = 0; i < nf; i++ ) {
+      std::fill( cornerFace.begin() + t.faceVert.offset[i], cornerFace.begin() + t.faceVert.offset[ i + 1 ], i );
+    }
+
+    // key = v0 * nv + v1 with v0 < v1, which fits 64 bits for nv <= 2^32.
+    // Wider meshes sort by v1 and then stably by v0 instead.
+    uint64_t nv = verts;
+    bool packed = nv <= ( uint64_t( 1 ) << 32 );
+    uint64_t span = packed ? nv * nv : nv;
+    int keybits = 0;
+    while( keybits < 64 && span > ( uint64_t( 1 ) << keybits ) ) {
+      keybits++;
+    }
+    vector<KeyIndex> hk( corners );
+    vector<char> bad( parallel_chunks( std::max( nf, corners ), threads ), 0 );
+    EdgeKeyFill fill = { &t, packed ? nv : 0, nv, corners ? &hk[0] : NULL, &bad[0] };
+    parallel_for( nf, threads, fill );
+    if( std::count( bad.begin(), bad.end(), 1 ) ) {
+      return false;
+    }
+    radix_sort( hk, keybits );
+    if( ! packed ) {
+      vector<Index> v0( corners ), v1( corners );
+      for( size_t i = 0; i < corners; i++ ) {
+        size_t c = hk[i].index;
+        size_t fi = cornerFace[ c ];
+        size_t j = c - t.faceVert.offset[ fi ];
+        Index j0 = t.faceVert.Begin( fi )[ j ];
+        Index j1 = t.faceVert.Begin( fi )[ ( j + 1 ) % t.faceVert.Count( fi ) ];
+        v0[c] = min( j0, j1 );
+        v1[c] = max( j0, j1 );
+        hk[i].key = v0[c];
+      }
+      radix_sort( hk, keybits );
+      // renumber keys by run so equal edges still compare equal below
+      uint64_t run = 0;
+      for( size_t i = 0; i < corners; i++ ) {
+        size_t c = hk[i].index;
+        if( i > 0 ) {
+          size_t p = hk[ i - 1 ].index;
+          run += ( v0[c] != v0[p] || v1[c] != v1[p] ) ? 1 : 0;
+        }
+        hk[i].key = run;
+      }
+    }
+
+    size_t chunks = parallel_chunks( corners, threads );
+    vector<size_t> runs( chunks );
+    if( corners ) {
+      EdgeRunCount rc = { &t, &hk[0], &cornerFace[0], &runs[0], &bad[0] };
+      parallel_for( corners, threads, rc );
+      if( std::count( bad.begin(), bad.end(), 1 ) ) {
+        return false;
+      }
+    }
+    size_t edges = 0;
+    for( size_t c = 0; c < chunks; c++ ) {
+      size_t r = runs[c];
+      runs[c] = edges;
+      edges += r;
+    }
+    t.edge.clear();
+    t.edge.resize( edges );
+    t.faceEdge.offset = t.faceVert.offset;
+    t.faceEdge.index.resize( corners );
+    if( corners ) {
+      EdgeAssign ea = { &t, &hk[0], &runs[0], &cornerFace[0] };
+      parallel_for( corners, threads, ea );
+    }
+    if( buildEdgeMap ) {
+      t.BuildEdgeMap();
+    }
+
+    derive_vert_adjacency( t, verts );
+    // stale half-edges would pass HasHalfEdges()
+    t.twin.clear();
+    t.cornerFace.clear();
+    t.vertOut.clear();
+    return true;
+  }
+
+
+  // Child edges of a split are laid out by construction, no lookups needed:
+  //   2 * e + 0, 2 * e + 1   halves of parent edge e, on its v0 and v1 side
+  //   2 * pe + c             face point to edge point of parent corner c's edge
+
+  // Writes the halves of parent edges [begin,end), creases decremented.
+  struct SplitEdges {
+    const Topo * t;
+    Topo * r;
+    size_t eb;
+    void operator()( size_t begin, size_t end, size_t ) {
+      for( size_t i = begin; i < end; i++ ) {
+        const Edge & pe = t->edge[i];
+        float crease = std::max( 0.0f, pe.crease - 1.0f );
+        Edge & e0 = r->edge[ 2 * i + 0 ];
+        Edge & e1 = r->edge[ 2 * i + 1 ];
+        e0 = Edge( pe.v0, Index( eb + i ), InvalidIndex );
+        e1 = Edge( pe.v1, Index( eb + i ), InvalidIndex );
+        e0.crease = e1.crease = crease;
+      }
+    }
+  };
+
+  // Writes the child quads of parent faces [begin,end) into their slots of
+  // the presized child faceVert and faceEdge, in the same order as the
+  // serial split, plus the interior child edges and the faces of every
+  // child edge. Each side of a child edge is set by exactly one child face.
+  // Child j is ( v[j], e[j], face point, e[j-1] ); quads keep their old
+  // layout, which is that child rotated by ( 4 - j ) % 4.
+  struct SplitFaces {
+    const Topo * t;
+    Topo * r;
+    size_t fb, eb;
+    void operator()( size_t begin, size_t end, size_t ) {
+      size_t pe = t->edge.size();
+      for( size_t i = begin; i < end; i++ ) {
+        const Index * f = t->faceVert.Begin(i);
+        const Index * fe = t->faceEdge.Begin(i);
+        size_t fv = t->faceVert.Count(i);
+        size_t base = t->faceVert.offset[i];
+        for( size_t j = 0; j < fv; j++ ) {
+          r->edge[ 2 * pe + base + j ] = Edge( Index( fb + i ), Index( eb + fe[j] ), InvalidIndex );
+        }
+        for( size_t j = 0; j < fv; j++ ) {
+          size_t jp = ( j + fv - 1 ) % fv;
+          const Edge & ej = t->edge[ fe[j] ];
+          const Edge & ejp = t->edge[ fe[jp] ];
+          Index cv[4] = { f[j], Index( eb + fe[j] ), Index( fb + i ), Index( eb + fe[jp] ) };
+          Index ce[4] = { Index( 2 * fe[j] + ( ej.v0 == f[j] ? 0 : 1 ) ),
+                          Index( 2 * pe + base + j ),
+                          Index( 2 * pe + base + jp ),
+                          Index( 2 * fe[jp] + ( ejp.v0 == f[j] ? 0 : 1 ) ) };
+          size_t rot = fv == 4 ? ( 4 - j ) % 4 : 0;
+          size_t cf = base + j;
+          Index * rf = r->faceVert.Begin( cf );
+          Index * rfe = r->faceEdge.Begin( cf );
+          for( size_t k = 0; k < 4; k++ ) {
+            rf[k] = cv[ ( k + rot ) % 4 ];
+            rfe[k] = ce[ ( k + rot ) % 4 ];
+          }
+          for( size_t k = 0; k < 4; k++ ) {
+            r->edge[ rfe[k] ].AddFace( rf[k], rf[ ( k + 1 ) % 4 ], Index( cf ) );
+          }
+        }
+      }
+    }
+  };
+
+  inline void sort_small( Index * a, size_t n ) {
+    for( size_t i = 1; i < n; i++ ) {
+      for( size_t j = i; j > 0 && a[j] < a[ j - 1 ]; j-- ) {
+        std::swap( a[j], a[ j - 1 ] );
+      }
+    }
+  }
+
+  // Fills the vertFace and vertEdge rows of child verts [begin,end), whose
+  // offsets are already set, straight from the parent. Rows come out
+  // ascending, as the transpose in derive_vert_adjacency() leaves them.
+  // An old vertex touches the child at each of its corners and one half of
+  // each of its edges, a face point the children and interior edges of its
+  // face, and an edge point its halves plus the children and interior
+  // edges on either side of it.
+  struct SplitVerts {
+    const Topo * t;
+    Topo * r;
+    void operator()( size_t begin, size_t end, size_t ) {
+      size_t pv = t->NumVerts();
+      size_t pf = t->NumFaces();
+      size_t pe = t->edge.size();
+      for( size_t i = begin; i < end; i++ ) {
+        Index * rf = r->vertFace.Begin(i);
+        Index * re = r->vertEdge.Begin(i);
+        if( i < pv ) {
+          const Index * vf = t->vertFace.Begin(i);
+          size_t nf = t->vertFace.Count(i);
+          for( size_t j = 0, k = 0; j < nf; j++ ) {
+            // a face listed again holds i at a later corner too
+            k = j > 0 && vf[j] == vf[ j - 1 ] ? k + 1 : 0;
+            const Index * f = t->faceVert.Begin( vf[j] );
+            while( f[k] != i ) {
+              k++;
+            }
+            *rf++ = Index( t->faceVert.offset[ vf[j] ] + k );
+          }
+          const Index * ve = t->vertEdge.Begin(i);
+          for( size_t j = 0; j < t->vertEdge.Count(i); j++ ) {
+            *re++ = Index( 2 * ve[j] + ( t->edge[ ve[j] ].v0 == i ? 0 : 1 ) );
+          }
+        } else if( i < pv + pf ) {
+          size_t f = i - pv;
+          size_t base = t->faceVert.offset[f];
+          for( size_t j = 0; j < t->faceVert.Count(f); j++ ) {
+            *rf++ = Index( base + j );
+            *re++ = Index( 2 * pe + base + j );
+          }
+        } else {
+          size_t e = i - pv - pf;
+          const Edge & pe0 = t->edge[e];
+          Index ef[2] = { pe0.f0, pe0.f1 };
+          Index * rf0 = rf;
+          Index * re0 = re;
+          *re++ = Index( 2 * e + 0 );
+          *re++ = Index( 2 * e + 1 );
+          for( size_t s = 0; s < 2; s++ ) {
+            if( ef[s] == InvalidIndex ) {
+              continue;
+            }
+            const Index * fe = t->faceEdge.Begin( ef[s] );
+            size_t fv = t->faceEdge.Count( ef[s] );
+            size_t base = t->faceEdge.offset[ ef[s] ];
+            size_t j = 0;
+            while( fe[j] != e ) {
+              j++;
+            }
+            *rf++ = Index( base + j );
+            *rf++ = Index( base + ( j + 1 ) % fv );
+            *re++ = Index( 2 * pe + base + j );
+          }
+          sort_small( rf0, rf - rf0 );
+          sort_small( re0 + 2, re - re0 - 2 );
+        }
+      }
+    }
+  };
+
+  // True when a level with the given element counts is indexable by Index.
+  bool fits_index( uint64_t verts, uint64_t faces, uint64_t edges, uint64_t corners ) {
+    uint64_t limit = uint64_t( InvalidIndex );
+    return verts < limit && faces < limit && edges < limit && corners < limit;
+  }
+
+  // Child verts come out of a split as [ verts | face points | edge points ],
+  // so the corners of one child face sit in three distant blocks. With
+  // reorderVerts set, split_topo() renumbers them in order of first use by
+  // the child faces, which follow the parent faces, so verts of nearby
+  // faces are nearby in memory for the gathers of average(), normals and
+  // the next split. vertOrder maps split slots to verts for average() and
+  // refine_stencils(); faces and edges keep their order.
+  bool reorderVerts = false;
+
+  struct ReorderEdges {
+    const Index * order;
+    Edge * edge;
+    void operator()( size_t begin, size_t end, size_t ) {
+      for( size_t i = begin; i < end; i++ ) {
+        Edge & e = edge[i];
+        e.v0 = order[ e.v0 ];
+        e.v1 = order[ e.v1 ];
+        if( e.v1 < e.v0 ) {
+          std::swap( e.v0, e.v1 );
+          std::swap( e.f0, e.f1 );
+        }
+      }
+    }
+  };
+
+  // Copies row i of from to row order[i] of to, whose offsets are set.
+  struct ReorderRows {
+    const Index * order;
+    const Csr * from;
+    Csr * to;
+    void operator()( size_t begin, size_t end, size_t ) {
+      for( size_t i = begin; i < end; i++ ) {
+        std::copy( from->Begin(i), from->Begin(i) + from->Count(i), to->Begin( order[i] ) );
+      }
+    }
+  };
+
+  void reorder_verts( Topo & t ) {
+    size_t threads = worker_threads();
+    size_t nv = t.NumVerts();
+    vector<Index> & order = t.vertOrder;
+    order.assign( nv, InvalidIndex );
+    Index next = 0;
+    for( size_t i = 0; i < t.faceVert.index.size(); i++ ) {
+      Index & v = t.faceVert.index[i];
+      if( order[v] == InvalidIndex ) {
+        order[v] = next++;
+      }
+      v = order[v];
+    }
+    for( size_t i = 0; i < nv; i++ ) {
+      if( order[i] == InvalidIndex ) {
+        order[i] = next++;
+      }
+    }
+    ReorderEdges re = { &order[0], t.edge.empty() ? NULL : &t.edge[0] };
+    parallel_for( t.edge.size(), threads, re );
+    Csr * rows[2] = { &t.vertFace, &t.vertEdge };
+    for( size_t k = 0; k < 2; k++ ) {
+      Csr r;
+      r.offset.resize( nv + 1 );
+      r.offset[0] = 0;
+      for( size_t i = 0; i < nv; i++ ) {
+        r.offset[ order[i] + 1 ] = Index( rows[k]->Count(i) );
+      }
+      for( size_t i = 0; i < nv; i++ ) {
+        r.offset[ i + 1 ] += r.offset[i];
+      }
+      r.index.resize( rows[k]->index.size() );
+      ReorderRows rr = { &order[0], rows[k], &r };
+      parallel_for( nv, threads, rr );
+      rows[k]->offset.swap( r.offset );
+      rows[k]->index.swap( r.index );
+    }
+  }
+
+  // Fills rt with the topology refined from t, reordering its verts when
+  // reorder is set.
+  void split_topo( const Topo & t, Topo & rt, bool reorder ) {
+    size_t pv = t.NumVerts(); // previous verts
+    size_t pf = t.NumFaces(); // previous faces
+    size_t pe = t.edge.size(); // previous faces
+    
+    // populate faces
+    size_t fb = pv;        // base offset for newly added per-face vertexes
+    size_t eb = pv + pf;   // base offset for newly added per-edge vertexes
+
+    // Every corner of a parent face becomes one child quad, so the children
+    // of face i start at child face t.faceVert.offset[i]: the parent's
+    // corner offsets are already the exclusive prefix sum of child counts.
+    size_t children = t.faceVert.index.size();
+    rt.faceVert.offset.resize( children + 1 );
+    rt.faceVert.index.resize( children * 4 );
+    for( size_t i = 0; i <= children; i++ ) {
+      rt.faceVert.offset[i] = Index( 4 * i );
+    }
+    rt.faceEdge.offset = rt.faceVert.offset;
+    rt.faceEdge.index.resize( children * 4 );
+    rt.edge.resize( 2 * pe + children );
+
+    // child edges, then refined mesh faces, written in place in parallel
+    size_t threads = worker_threads();
+    SplitEdges se = { &t, &rt, eb };
+    parallel_for( pe, threads, se );
+    SplitFaces sf = { &t, &rt, fb, eb };
+    parallel_for( pf, threads, sf );
+
+    // child vertex rows, sized from the parent: old verts keep their face
+    // and edge counts, face points get one of each per corner, and edge
+    // points two faces and one edge per side plus the two halves
+    size_t nv = pv + pf + pe;
+    rt.vertFace.offset.resize( nv + 1 );
+    rt.vertEdge.offset.resize( nv + 1 );
+    rt.vertFace.offset[0] = rt.vertEdge.offset[0] = 0;
+    for( size_t i = 0; i < nv; i++ ) {
+      size_t faces, edges;
+      if( i < pv ) {
+        faces = t.vertFace.Count(i);
+        edges = t.vertEdge.Count(i);
+      } else if( i < pv + pf ) {
+        faces = edges = t.faceVert.Count( i - pv );
+      } else {
+        const Edge & e = t.edge[ i - pv - pf ];
+        size_t sides = ( e.f0 != InvalidIndex ) + ( e.f1 != InvalidIndex );
+        faces = 2 * sides;
+        edges = 2 + sides;
+      }
+      rt.vertFace.offset[ i + 1 ] = Index( rt.vertFace.offset[i] + faces );
+      rt.vertEdge.offset[ i + 1 ] = Index( rt.vertEdge.offset[i] + edges );
+    }
+    rt.vertFace.index.resize( rt.vertFace.offset[ nv ] );
+    rt.vertEdge.index.resize( rt.vertEdge.offset[ nv ] );
+    SplitVerts sv = { &t, &rt };
+    parallel_for( nv, threads, sv );
+    rt.vertOrder.clear();
+    rt.reordered = reorder;
+    if( reorder ) {
+      reorder_verts( rt );
+    }
+    if( halfEdges ) {
+      build_half_edges( rt );
+    } else {
+      rt.twin.clear();
+      rt.cornerFace.clear();
+      rt.vertOut.clear();
+    }
+    rt.stamp = next_stamp();
+  }
+
+  void split_topo( const Topo & t, Topo & rt ) {
+    split_topo( t, rt, reorderVerts );
+  }
+
+  // Whether the split of t, as the given level, fits Index. Prints why
+  // not otherwise.
+  bool split_fits( const Topo & t, size_t level ) {
+    uint64_t corners = t.faceVert.index.size();
+    uint64_t verts = uint64_t( t.NumVerts() ) + t.NumFaces() + t.edge.size();
+    if( ! fits_index( verts, corners, 2 * t.edge.size() + corners, 4 * corners ) ) {
+      fprintf( stderr, "subdiv: level %d does not fit %d-bit indices, build with -DSUBDIV_INDEX64\n",
+               int( level ), int( sizeof( Index ) * 8 ) );
+      return false;
+    }
+    return true;
+  }
+
+  // Replaces the levels below m with the split of m. When that does not
+  // fit Index they are dropped, m.next is left NULL and false returned.
+  bool split_model( Model & m ) {
+    delete m.next;
+    m.next = NULL;
+    if( ! split_fits( m.topo, m.level + 1 ) ) {
+      return false;
+    }
+    m.next = new Model();
+    m.next->prev = &m;
+    m.next->level = m.level + 1;
+    split_topo( m.topo, m.next->topo );
+    return true;
+  }
+
+  // Level cache
+  //
+  // A refined level can be evicted, which drops its data but keeps its
+  // place in the chain, and is re-derived from the nearest resident level
+  // above it by touch_level(). trim_levels() evicts the least recently
+  // touched refined levels until they fit levelBudget bytes, 0 meaning no
+  // budget. The cage is never evicted.
+  //
+  // With quantizeLevels set it first quantizes resident levels, least
+  // recently touched first and keep included, which keeps them drawable
+  // in well under half their bytes. touch_level( m, true ) re-derives
+  // the exact level when a split, update or save needs it.
+  size_t levelBudget = 0;
+  size_t levelClock = 0;
+  bool quantizeLevels = false;
+
+  size_t resident_bytes( const Model & m ) {
+    return ( m.vpos.capacity() + m.vnrm.capacity() + m.fnrm.capacity() ) * sizeof( Vec3f ) +
+           m.spos.Bytes() + m.topo.Bytes() + m.quant.Bytes();
+  }
+
+  void evict_level( Model & m ) {
+    if( m.prev == NULL || m.evicted ) {
+      return;
+    }
+    vector<Vec3f>().swap( m.vpos );
+    vector<Vec3f>().swap( m.vnrm );
+    vector<Vec3f>().swap( m.fnrm );
+    m.spos.Release();
+    m.topo.Release();
+    m.quant.Release();
+    m.quantized = false;
+    m.evicted = true;
+  }
+
+  // Encodes patches [begin,end) of m into q and tracks the largest errors
+  // of each chunk.
+  struct QuantEncode {
+    const Model * m;
+    QuantLevel * q;
+    float * posError;
+    float * nrmError;
+    void operator()( size_t begin, size_t end, size_t thread ) {
+      size_t nv = m->vpos.size();
+      float pe = 0.0f;
+      double ne = 0.0;
+      for( size_t p = begin; p < end; p++ ) {
+        size_t v0 = p * QuantPatch, v1 = std::min( v0 + QuantPatch, nv );
+        Vec3f lo = m->vpos[ v0 ], hi = lo;
+        for( size_t v = v0 + 1; v < v1; v++ ) {
+          const Vec3f & a = m->vpos[v];
+          lo = Vec3f( std::min( lo.x, a.x ), std::min( lo.y, a.y ), std::min( lo.z, a.z ) );
+          hi = Vec3f( std::max( hi.x, a.x ), std::max( hi.y, a.y ), std::max( hi.z, a.z ) );
+        }
+        Vec3f d = ( hi - lo ) / 65535.0f;
+        q->base[p] = lo;
+        q->step[p] = d;
+        for( size_t v = v0; v < v1; v++ ) {
+          const Vec3f & a = m->vpos[v];
+          uint16_t * qp = &q->pos[ 3 * v ];
+          qp[0] = d.x > 0.0f ? uint16_t( std::min( ( a.x - lo.x ) / d.x + 0.5f, 65535.0f ) ) : 0;
+          qp[1] = d.y > 0.0f ? uint16_t( std::min( ( a.y - lo.y ) / d.y + 0.5f, 65535.0f ) ) : 0;
+          qp[2] = d.z > 0.0f ? uint16_t( std::min( ( a.z - lo.z ) / d.z + 0.5f, 65535.0f ) ) : 0;
+          Vec3f e = q->Position( v ) - a;
+          pe = std::max( pe, std::max( fabsf( e.x ), std::max( fabsf( e.y ), fabsf( e.z ) ) ) );
+
+          // project onto the octahedron, folding the lower half outwards
+          const Vec3f & n = m->vnrm[v];
+          float l1 = fabsf( n.x ) + fabsf( n.y ) + fabsf( n.z );
+          if( l1 == 0.0f ) {
+            q->nrm[ 2 * v ] = q->nrm[ 2 * v + 1 ] = 0;
+            continue;
+          }
+          float x = n.x / l1, y = n.y / l1;
+          if( n.z < 0.0f ) {
+            float fx = ( 1.0f - fabsf( y ) ) * ( x < 0.0f ? -1.0f : 1.0f );
+            y = ( 1.0f - fabsf( x ) ) * ( y < 0.0f ? -1.0f : 1.0f );
+            x = fx;
+          }
+          q->nrm[ 2 * v ] = int16_t( floorf( std::max( -1.0f, std::min( x, 1.0f ) ) * 32767.0f + 0.5f ) );
+          q->nrm[ 2 * v + 1 ] = int16_t( floorf( std::max( -1.0f, std::min( y, 1.0f ) ) * 32767.0f + 0.5f ) );
+          // angle from the chord between the unit vectors
+          Vec3f c = q->Normal( v ) - n / n.Length();
+          ne = std::max( ne, 2.0 * asin( std::min( 1.0, 0.5 * sqrt( double( c.Dot( c ) ) ) ) ) );
+        }
+      }
+      posError[ thread ] = std::max( posError[ thread ], pe );
+      nrmError[ thread ] = std::max( nrmError[ thread ], float( ne ) );
+    }
+  };
+
+  // Replaces the float data of finished refined level m by its quantized
+  // form and drops the adjacency that only splits and averages use.
+  // Position and normal errors are measured against the floats and kept
+  // in m.quant. False when m has nothing to quantize.
+  bool quantize_level( Model & m ) {
+    size_t nv = m.vpos.size();
+    if( m.prev == NULL || m.evicted || m.quantized || nv == 0 || m.vnrm.size() != nv ) {
+      return false;
+    }
+    size_t patches = ( nv + QuantPatch - 1 ) / QuantPatch;
+    size_t threads = worker_threads();
+    QuantLevel & q = m.quant;
+    q.pos.resize( 3 * nv );
+    q.nrm.resize( 2 * nv );
+    q.base.resize( patches );
+    q.step.resize( patches );
+    vector<float> posError( threads, 0.0f ), nrmError( threads, 0.0f );
+    QuantEncode qe = { &m, &q, &posError[0], &nrmError[0] };
+    parallel_for( patches, threads, qe, 64 );
+    q.posError = *std::max_element( posError.begin(), posError.end() );
+    q.nrmError = *std::max_element( nrmError.begin(), nrmError.end() );
+    vector<Vec3f>().swap( m.vpos );
+    vector<Vec3f>().swap( m.vnrm );
+    vector<Vec3f>().swap( m.fnrm );
+    m.spos.Release();
+    m.topo.ReleaseAdjacency();
+    m.quantized = true;
+    m.stamp = next_stamp();
+    return true;
+  }
+
+  // Whether m holds its data, exact data with exact set.
+  bool level_ok( const Model & m, bool exact ) {
+    return ! m.evicted && ! ( exact && m.quantized );
+  }
+
+  // Makes m resident again if it was evicted and marks it used. With exact
+  // set, a quantized m is re-derived from the level above as well. When
+  // that fails, m is left as it was, which callers check with level_ok().
+  Model & touch_level( Model & m, bool exact = false ) {
+    if( ! level_ok( m, exact ) ) {
+      Model & p = touch_level( *m.prev, true );
+      if( level_ok( p, true ) && split_fits( p.topo, m.level ) ) {
+        split_topo( p.topo, m.topo, m.topo.reordered );
+        average( m );
+        finish_level( m );
+        m.quant.Release();
+        m.quantized = false;
+        m.evicted = false;
+      }
+    }
+    m.lastUse = ++levelClock;
+    return m;
+  }
+
+  // Quantizes, with quantizeLevels set, then evicts refined levels of the
+  // chain under cage, least recently touched first and never evicting
+  // keep, until the resident ones fit levelBudget.
+  void trim_levels( Model & cage, const Model * keep ) {
+    if( levelBudget == 0 ) {
+      return;
+    }
+    for( ;; ) {
+      size_t total = 0;
+      Model * lru = NULL, * squeeze = NULL;
+      for( Model * m = cage.next; m != NULL; m = m->next ) {
+        if( m->evicted ) {
+          continue;
+        }
+        total += resident_bytes( *m );
+        if( m != keep && ( lru == NULL || m->lastUse < lru->lastUse ) ) {
+          lru = m;
+        }
+        if( quantizeLevels && ! m->quantized && ( squeeze == NULL || m->lastUse < squeeze->lastUse ) ) {
+          squeeze = m;
+        }
+      }
+      if( total <= levelBudget ) {
+        return;
+      }
+      if( squeeze != NULL && quantize_level( *squeeze ) ) {
+        continue;
+      }
+      if( lru == NULL ) {
+        return;
+      }
+      evict_level( *lru );
+    }
+  }
+
+  void report_levels( const Model & cage ) {
+    size_t total = 0;
+    for( const Model * m = &cage; m != NULL; m = m->next ) {
+      size_t bytes = m->evicted ? 0 : resident_bytes( *m );
+      total += bytes;
+      printf( "  level %d  %10.3f MB%s", int( m->level ), bytes / 1048576.0, m->evicted ? "  evicted" : "" );
+      if( m->quantized ) {
+        printf( "  quantized, position error %.3g, normal error %.3g deg",
+                m->quant.posError, m->quant.nrmError * 180.0 / M_PI );
+      }
+      printf( "\n" );
+    }
+    printf( "  total    %10.3f MB, budget %.3f MB\n", total / 1048576.0, levelBudget / 1048576.0 );
+  }
+
+  // Incremental updates
+  //
+  // When a few cage verts move, the next level only changes in the children
+  // of the faces around them, and so on down the chain. update_levels()
+  // follows that region level by level and re-runs the average and normal
+  // kernels on it alone. They run on aligned blocks of DirtyBlock elements,
+  // a multiple of the simd width, so a block gives the same results as in
+  // a serial full pass.
+  const size_t DirtyBlock = 16;
+
+  // Scratch of update_levels(). Lists are built unsorted and without
+  // repeats with the help of mark, which is all zero between calls.
+  struct DirtyRegion {
+    vector<Index> faces, edges, ring;
+    vector<Index> faceBlocks, blocks;
+    vector<unsigned char> mark;
+    void Begin( vector<Index> & out, size_t range ) {
+      out.clear();
+      if( mark.size() < range ) {
+        mark.resize( range, 0 );
+      }
+    }
+    void Add( vector<Index> & out, Index i ) {
+      if( ! mark[i] ) {
+        mark[i] = 1;
+        out.push_back( i );
+      }
+    }
+    void End( const vector<Index> & out ) {
+      for( size_t i = 0; i < out.size(); i++ ) {
+        mark[ out[i] ] = 0;
+      }
+    }
+    // The entries of the rows of c for the given items, in [0,range).
+    void Rows( const Csr & c, const vector<Index> & items, size_t range, vector<Index> & out ) {
+      Begin( out, range );
+      for( size_t i = 0; i < items.size(); i++ ) {
+        const Index * r = c.Begin( items[i] );
+        for( size_t j = 0; j < c.Count( items[i] ); j++ ) {
+          Add( out, r[j] );
+        }
+      }
+      End( out );
+    }
+    // The blocks holding the given items of [0,range).
+    void Blocks( const vector<Index> & items, size_t range, vector<Index> & out ) {
+      Begin( out, range / DirtyBlock + 1 );
+      for( size_t i = 0; i < items.size(); i++ ) {
+        Add( out, Index( items[i] / DirtyBlock ) );
+      }
+      End( out );
+    }
+  };
+
+  template< typename Body >
+  struct BlockBody {
+    const vector<Index> * blocks;
+    size_t count;
+    Body * body;
+    void operator()( size_t begin, size_t end, size_t thread ) {
+      for( size_t i = begin; i < end; i++ ) {
+        size_t b = size_t( ( *blocks )[i] ) * DirtyBlock;
+        ( *body )( b, std::min( b + DirtyBlock, count ), thread );
+      }
+    }
+  };
+
+  // Calls body on each of the blocks of [0,count), as parallel_for would.
+  template< typename Body >
+  void parallel_blocks( const vector<Index> & blocks, size_t count, Body & body ) {
+    BlockBody<Body> bb = { &blocks, count, &body };
+    parallel_for( blocks.size(), worker_threads(), bb, 4096 / DirtyBlock );
+  }
+
+  // The finish_level() of m for the given changed verts of m.spos, or of
+  // m.vpos on the cage: face normals of the faces around them, then normals
+  // and limit positions of the verts of those faces.
+  void update_finish( Model & m, const vector<Index> & verts, DirtyRegion & d ) {
+    const Topo & t = m.topo;
+    size_t nf = t.NumFaces(), nv = m.vpos.size();
+    d.Rows( t.vertFace, verts, nf, d.faces );
+    d.Blocks( d.faces, nf, d.faceBlocks );
+    d.Begin( d.ring, nv );
+    for( size_t i = 0; i < d.faceBlocks.size(); i++ ) {
+      size_t b = size_t( d.faceBlocks[i] ) * DirtyBlock;
+      size_t e = std::min( b + DirtyBlock, nf );
+      for( size_t j = t.faceVert.offset[b]; j < t.faceVert.offset[e]; j++ ) {
+        d.Add( d.ring, t.faceVert.index[j] );
+      }
+    }
+    d.End( d.ring );
+    d.Blocks( d.ring, nv, d.blocks );
+    if( m.prev != NULL ) {
+      // control points, as finish_level() finds them after average()
+      for( size_t i = 0; i < d.blocks.size(); i++ ) {
+        size_t b = size_t( d.blocks[i] ) * DirtyBlock;
+        for( size_t v = b; v < std::min( b + DirtyBlock, nv ); v++ ) {
+          m.vpos[v] = m.spos.Get( v );
+        }
+      }
+    }
+    FaceNormals fn = { &m };
+    parallel_blocks( d.faceBlocks, nf, fn );
+    if( limitSurface && m.prev != NULL ) {
+      LimitVerts lv = { &m, &limit_masks() };
+      parallel_blocks( d.blocks, nv, lv );
+    } else {
+      VertexNormals vn = { &m };
+      parallel_blocks( d.blocks, nv, vn );
+    }
+    m.stamp = next_stamp();
+  }
+
+  // The average() of m for the given changed verts of m.prev, leaving the
+  // verts of m that changed in out.
+  void update_average( Model & m, const vector<Index> & verts, DirtyRegion & d, vector<Index> & out ) {
+    const Model & prev = *m.prev;
+    const Topo & pt = prev.topo;
+    size_t pv = pt.NumVerts();
+    size_t pf = pt.NumFaces();
+    size_t pe = pt.edge.size();
+    d.Rows( pt.vertFace, verts, pf, d.faces );
+    d.Rows( pt.faceEdge, d.faces, pe, d.edges );
+    d.Rows( pt.faceVert, d.faces, pv, d.ring );
+
+    // in average() order, edge and vertex points read the face points
+    d.Blocks( d.faces, pf, d.blocks );
+    AverageFaces af = { &pt, &prev.spos, &m.spos, pv };
+    parallel_blocks( d.blocks, pf, af );
+    d.Blocks( d.edges, pe, d.blocks );
+    AverageEdges ae = { &pt, &prev.spos, &m.spos, pv, pv + pf };
+    parallel_blocks( d.blocks, pe, ae );
+    d.Blocks( d.ring, pv, d.blocks );
+    AverageVerts av = { &pt, &prev.spos, &m.spos, pv };
+    parallel_blocks( d.blocks, pv, av );
+
+    out.assign( d.ring.begin(), d.ring.end() );
+    for( size_t i = 0; i < d.faces.size(); i++ ) {
+      out.push_back( Index( pv + d.faces[i] ) );
+    }
+    for( size_t i = 0; i < d.edges.size(); i++ ) {
+      out.push_back( Index( pv + pf + d.edges[i] ) );
+    }
+  }
+
+  // Brings the levels under cage up to date after the cage verts in moved
+  // were edited in cage.vpos, only re-running the kernels on what depends
+  // on them. A quantized level and the levels below it, or below an evicted
+  // one, are evicted, touch_level() rebuilds them from the new cage. Levels with reordered verts, see
+  // reorderVerts, and levels where most of the mesh changed are averaged
+  // in full.
+  void update_levels( Model & cage, const vector<Index> & moved ) {
+    DirtyRegion d;
+    vector<Index> verts, next;
+    d.Begin( verts, cage.vpos.size() );
+    for( size_t i = 0; i < moved.size(); i++ ) {
+      d.Add( verts, moved[i] );
+    }
+    d.End( verts );
+    if( cage.spos.Size() != cage.vpos.size() ) {
+      to_soa( cage.vpos, cage.spos );
+    }
+    for( size_t i = 0; i < verts.size(); i++ ) {
+      cage.spos.Set( verts[i], cage.vpos[ verts[i] ] );
+    }
+    update_finish( cage, verts, d );
+    bool full = false;
+    for( Model * m = cage.next; m != NULL; m = m->next ) {
+      if( m->evicted || m->quantized ) {
+        for( Model * n = m; n != NULL; n = n->next ) {
+          evict_level( *n );
+        }
+        return;
+      }
+      // past about a quarter of the level a full pass is cheaper
+      full = full || m->topo.reordered || 4 * verts.size() > m->prev->vpos.size();
+      if( full ) {
+        average( *m );
+        finish_level( *m );
+        continue;
+      }
+      update_average( *m, verts, d, next );
+      verts.swap( next );
+      update_finish( *m, verts, d );
+    }
+  }
+  
+  // Every vertex of one refined level as a sparse weighted sum of cage
+  // ( level 0 ) vertices. Row i is src.index / weight over src.offset[i].
+  // Valid for as long as the topology and creases of the chain are unchanged.
+  struct StencilTable {
+    StencilTable() : level( 0 ), cageVerts( 0 ) {}
+    Csr src;
+    vector<float> weight;
+    size_t level;
+    size_t cageVerts;
+    size_t Size() const {
+      return src.Size();
+    }
+  };
+
+  // Dense scratch row over the cage vertices, with the list of touched
+  // entries so it can be emitted and cleared in time proportional to them.
+  struct StencilRow {
+    vector<float> w;
+    vector<unsigned char> used;
+    vector<Index> touched;
+    void Resize( size_t cageVerts ) {
+      w.assign( cageVerts, 0.0f );
+      used.assign( cageVerts, 0 );
+    }
+    // adds a * ( row u of prev ) to this row
+    void Add( const StencilTable & prev, Index u, float a ) {
+      const Index * s = prev.src.Begin( u );
+      const float * sw = &prev.weight[0] + prev.src.offset[u];
+      for( size_t j = 0; j < prev.src.Count( u ); j++ ) {
+        if( ! used[ s[j] ] ) {
+          used[ s[j] ] = 1;
+          touched.push_back( s[j] );
+        }
+        w[ s[j] ] += a * sw[j];
+      }
+    }
+    void Emit( StencilTable & out ) {
+      sort( touched.begin(), touched.end() );
+      for( size_t j = 0; j < touched.size(); j++ ) {
+        Index c = touched[j];
+        if( w[c] != 0.0f ) {
+          out.src.index.push_back( c );
+          out.weight.push_back( w[c] );
+        }
+        w[c] = 0.0f;
+        used[c] = 0;
+      }
+      out.src.offset.push_back( Index( out.src.index.size() ) );
+      touched.clear();
+    }
+  };
+
+  // Builds the stencils of level m.next from those of level m, applying the
+  // same face, edge and vertex rules ( creases included ) as average().
+  void refine_stencils( const Model & m, const StencilTable & prev, StencilRow & row, StencilTable & out ) {
+    const Topo & pt = m.topo;
+    size_t pv = pt.NumVerts();
+    size_t pf = pt.NumFaces();
+    size_t pe = pt.edge.size();
+    out.level = prev.level + 1;
+    out.cageVerts = prev.cageVerts;
+    out.src.Clear();
+    out.src.offset.reserve( pv + pf + pe + 1 );
+    out.src.index.clear();
+    out.weight.clear();
+
+    // original verts
+    for( size_t i = 0; i < pv; i++ ) {
+      const Index * ve = pt.vertEdge.Begin(i);
+      const Index * vf = pt.vertFace.Begin(i);
+      size_t valence = pt.vertEdge.Count(i);
+      size_t faces = pt.vertFace.Count(i);
+      bool creased = valence == 0;
+      for( size_t j = 0; j < valence; j++ ) {
+        creased = creased || pt.edge[ ve[j] ].crease > 0.0f;
+      }
+      if( creased ) {
+        row.Add( prev, Index( i ), 1.0f );
+      } else {
+        float n = float( valence );
+        for( size_t j = 0; j < faces; j++ ) {
+          const Index * f = pt.faceVert.Begin( vf[j] );
+          size_t fv = pt.faceVert.Count( vf[j] );
+          for( size_t k = 0; k < fv; k++ ) {
+            row.Add( prev, f[k], 1.0f / ( n * float( faces ) * float( fv ) ) );
+          }
+        }
+        for( size_t j = 0; j < valence; j++ ) {
+          const Edge & e = pt.edge[ ve[j] ];
+          row.Add( prev, e.v0, 1.0f / ( n * n ) );
+          row.Add( prev, e.v1, 1.0f / ( n * n ) );
+        }
+        row.Add( prev, Index( i ), ( n - 3.0f ) / n );
+      }
+      row.Emit( out );
+    }
+
+    // per-face verts
+    for( size_t i = 0; i < pf; i++ ) {
+      const Index * f = pt.faceVert.Begin(i);
+      size_t fv = pt.faceVert.Count(i);
+      for( size_t j = 0; j < fv; j++ ) {
+        row.Add( prev, f[j], 1.0f / float( fv ) );
+      }
+      row.Emit( out );
+    }
+
+    // per-edge verts
+    for( size_t i = 0; i < pe; i++ ) {
+      const Edge & e = pt.edge[i];
+      Index ef[2] = { e.f0, e.f1 };
+      float count = 2.0f;
+      for( size_t j = 0; j < 2; j++ ) {
+        count += ( e.crease == 0.0f && ef[j] != InvalidIndex ) ? 1.0f : 0.0f;
+      }
+      row.Add( prev, e.v0, 1.0f / count );
+      row.Add( prev, e.v1, 1.0f / count );
+      for( size_t j = 0; j < 2; j++ ) {
+        if( e.crease == 0.0f && ef[j] != InvalidIndex ) {
+          const Index * f = pt.faceVert.Begin( ef[j] );
+          size_t fv = pt.faceVert.Count( ef[j] );
+          for( size_t k = 0; k < fv; k++ ) {
+            row.Add( prev, f[k], 1.0f / ( count * float( fv ) ) );
+          }
+        }
+      }
+      row.Emit( out );
+    }
+
+    // from split slots to the reordered verts
+    const vector<Index> & order = m.next->topo.vertOrder;
+    if( ! order.empty() ) {
+      StencilTable r;
+      r.src.offset.resize( order.size() + 1 );
+      r.src.offset[0] = 0;
+      for( size_t i = 0; i < order.size(); i++ ) {
+        r.src.offset[ order[i] + 1 ] = Index( out.src.Count(i) );
+      }
+      for( size_t i = 0; i < order.size(); i++ ) {
+        r.src.offset[ i + 1 ] += r.src.offset[i];
+      }
+      r.src.index.resize( out.src.index.size() );
+      r.weight.resize( out.weight.size() );
+      for( size_t i = 0; i < order.size(); i++ ) {
+        size_t from = out.src.offset[i], to = r.src.offset[ order[i] ];
+        std::copy( out.src.Begin(i), out.src.Begin(i) + out.src.Count(i), r.src.Begin( order[i] ) );
+        std::copy( out.weight.begin() + from, out.weight.begin() + from + out.src.Count(i), r.weight.begin() + to );
+      }
+      out.src.offset.swap( r.src.offset );
+      out.src.index.swap( r.src.index );
+      out.weight.swap( r.weight );
+    }
+  }
+
+  // Walks the prev/next chain from the cage up to the given level, which
+  // must already be refined, and bakes that level's stencils into st.
+  // Quantized or evicted levels on the way are made exact first, as the
+  // stencils need their adjacency and vertOrder.
+  bool build_stencil_table( Model & cage, size_t level, StencilTable & st ) {
+    size_t nv = cage.topo.NumVerts();
+    StencilTable prev;
+    prev.cageVerts = nv;
+    prev.src.Clear();
+    for( size_t i = 0; i < nv; i++ ) {
+      prev.src.index.push_back( Index( i ) );
+      prev.src.offset.push_back( Index( i + 1 ) );
+      prev.weight.push_back( 1.0f );
+    }
+    StencilRow row;
+    row.Resize( nv );
+    Model * m = &cage;
+    while( prev.level < level ) {
+      if( m->next == NULL || ! level_ok( touch_level( *m->next, true ), true ) ||
+          ! level_ok( touch_level( *m, true ), true ) ) {
+        return false;
+      }
+      refine_stencils( *m, prev, row, st );
+      std::swap( prev, st );
+      m = m->next;
+    }
+    std::swap( prev, st );
+    return true;
+  }
+
+  struct StencilApply {
+    const StencilTable * st;
+    const Vec3f * src;
+    Vec3f * dst;
+    void operator()( size_t begin, size_t end, size_t ) {
+      const Index * idx = st->src.Begin( 0 );
+      const float * w = &st->weight[0];
+      for( size_t i = begin; i < end; i++ ) {
+        Vec3f p( 0, 0, 0 );
+        for( size_t j = st->src.offset[i]; j < st->src.offset[ i + 1 ]; j++ ) {
+          p += src[ idx[j] ] * w[j];
+        }
+        dst[i] = p;
+      }
+    }
+  };
+
+  // Evaluates a stencil table against new cage positions: one sparse
+  // matrix-vector product, split across threads by rows.
+  void apply_stencils( const StencilTable & st, const vector<Vec3f> & cage, vector<Vec3f> & out ) {
+    assert( cage.size() == st.cageVerts );
+    out.resize( st.Size() );
+    if( out.empty() || st.weight.empty() ) {
+      return;
+    }
+    StencilApply a = { &st, &cage[0], &out[0] };
+    parallel_for( out.size(), worker_threads(), a );
+  }
+
+  // Wall time spent in each phase of subdivide_model.
+  struct PhaseTimes {
+    PhaseTimes() : split( 0 ), average( 0 ), normals( 0 ) {}
+    double split, average, normals;
+    double Total() const {
+      return split + average + normals;
+    }
+  };
+
+  // Refines m into a new m.next, replacing any levels below it. False,
+  // with m.next NULL, when m cannot be made exact or the split does not fit.
+  bool subdivide_model( Model & m, PhaseTimes * times = NULL ) {
+    PhaseTimes pt;
+    if( ! level_ok( touch_level( m, true ), true ) ) {
+      delete m.next;
+      m.next = NULL;
+      return false;
+    }
+    double t = seconds();
+    if( ! split_model( m ) ) {
+      return false;
+    }
+    pt.split = seconds() - t;
+    t = seconds();
+    average( *m.next );
+    pt.average = seconds() - t;
+    t = seconds();
+    finish_level( *m.next );
+    pt.normals = seconds() - t;
+    if( times ) {
+      *times = pt;
+    }
+    return true;
+  }
+
+  // Refines m once serially and once with worker_threads() workers, and
+  // prints the per-phase times and speedups. Leaves m.next refined.
+  void report_speedup( Model & m ) {
+    size_t saved = workerCount;
+    PhaseTimes serial, threaded;
+    workerCount = 1;
+    subdivide_model( m, &serial );
+    workerCount = saved;
+    if( ! subdivide_model( m, &threaded ) ) {
+      return;
+    }
+    printf( "level %d, %d faces, %d threads\n", int( m.level + 1 ),
+            int( m.next->topo.NumFaces() ), int( worker_threads() ) );
+    printf( "  split   %8.2f ms  %8.2f ms  %5.2fx\n", serial.split * 1e3, threaded.split * 1e3, serial.split / threaded.split );
+    printf( "  average %8.2f ms  %8.2f ms  %5.2fx\n", serial.average * 1e3, threaded.average * 1e3, serial.average / threaded.average );
+    printf( "  normals %8.2f ms  %8.2f ms  %5.2fx\n", serial.normals * 1e3, threaded.normals * 1e3, serial.normals / threaded.normals );
+    printf( "  total   %8.2f ms  %8.2f ms  %5.2fx\n", serial.Total() * 1e3, threaded.Total() * 1e3, serial.Total() / threaded.Total() );
+  }
+
+  // Flat arrays to draw a level with one call per primitive: interleaved
+  // position and normal, faces as triangle fans, and edges as lines. GL
+  // takes 32-bit indices at most, whatever the width of Index.
+  struct DrawArrays {
+    vector<float> vertex;
+    vector<uint32_t> tris;
+    vector<uint32_t> lines;
+  };
+
+  void build_draw_vertices( const Model & m, DrawArrays & da ) {
+    if( m.quantized ) {
+      size_t nv = m.quant.Size();
+      da.vertex.resize( nv * 6 );
+      for( size_t i = 0; i < nv; i++ ) {
+        Vec3f p = m.quant.Position( i ), n = m.quant.Normal( i );
+        float * v = &da.vertex[ i * 6 ];
+        v[0] = p.x;
+        v[1] = p.y;
+        v[2] = p.z;
+        v[3] = n.x;
+        v[4] = n.y;
+        v[5] = n.z;
+      }
+      return;
+    }
+    size_t nv = m.vpos.size();
+    da.vertex.resize( nv * 6 );
+    for( size_t i = 0; i < nv; i++ ) {
+      float * v = &da.vertex[ i * 6 ];
+      v[0] = m.vpos[i].x;
+      v[1] = m.vpos[i].y;
+      v[2] = m.vpos[i].z;
+      v[3] = m.vnrm[i].x;
+      v[4] = m.vnrm[i].y;
+      v[5] = m.vnrm[i].z;
+    }
+  }
+
+  void build_draw_indices( const Topo & t, DrawArrays & da ) {
+    size_t nf = t.NumFaces();
+    da.tris.resize( 3 * ( t.faceVert.index.size() - 2 * nf ) );
+    uint32_t * tri = da.tris.empty() ? NULL : &da.tris[0];
+    for( size_t i = 0; i < nf; i++ ) {
+      const Index * f = t.faceVert.Begin(i);
+      for( size_t j = 1; j + 1 < t.faceVert.Count(i); j++ ) {
+        *tri++ = uint32_t( f[0] );
+        *tri++ = uint32_t( f[j] );
+        *tri++ = uint32_t( f[ j + 1 ] );
+      }
+    }
+    da.lines.resize( 2 * t.edge.size() );
+    for( size_t i = 0; i < t.edge.size(); i++ ) {
+      da.lines[ 2 * i + 0 ] = uint32_t( t.edge[i].v0 );
+      da.lines[ 2 * i + 1 ] = uint32_t( t.edge[i].v1 );
+    }
+  }
+
+  // Cage loading
+
+  // Read-only memory mapping of a whole file.
+  struct MappedFile {
+    MappedFile() : data( NULL ), size( 0 ) {}
+    ~MappedFile() {
+      Close();
+    }
+    bool Open( const char * path ) {
+      Close();
+      int fd = open( path, O_RDONLY );
+      if( fd < 0 ) {
+        return false;
+      }
+      struct stat st;
+      if( fstat( fd, &st ) == 0 && st.st_size > 0 ) {
+        void * p = mmap( NULL, size_t( st.st_size ), PROT_READ, MAP_PRIVATE, fd, 0 );
+        if( p != MAP_FAILED ) {
+          data = (const char *)p;
+          size = size_t( st.st_size );
+        }
+      }
+      close( fd );
+      return data != NULL;
+    }
+    void Close() {
+      if( data ) {
+        munmap( (void *)data, size );
+      }
+      data = NULL;
+      size = 0;
+    }
+    const char * data;
+    size_t size;
+  private:
+    MappedFile( const MappedFile & );
+    MappedFile & operator=( const MappedFile & );
+  };
+
+  // Allocation-free text scanning over [p,end), for parsers that walk
+  // mapped files. Each returns where it stopped.
+
+  inline bool is_space( char c ) {
+    return c == ' ' || c == '\t' || c == '\r';
+  }
+
+  inline const char * skip_space( const char * p, const char * end ) {
+    while( p < end && is_space( *p ) ) {
+      p++;
+    }
+    return p;
+  }
+
+  inline const char * skip_token( const char * p, const char * end ) {
+    while( p < end && ! is_space( *p ) && *p != '\n' ) {
+      p++;
+    }
+    return p;
+  }
+
+  inline const char * next_line( const char * p, const char * end ) {
+    while( p < end && *p != '\n' ) {
+      p++;
+    }
+    return p < end ? p + 1 : end;
+  }
+
+  const char * parse_int( const char * p, const char * end, long & v, bool & ok ) {
+    bool neg = p < end && *p == '-';
+    if( p < end && ( *p == '-' || *p == '+' ) ) {
+      p++;
+    }
+    const char * digits = p;
+    long r = 0;
+    while( p < end && *p >= '0' && *p <= '9' ) {
+      r = r * 10 + ( *p++ - '0' );
+    }
+    ok = ok && p != digits;
+    v = neg ? -r : r;
+    return p;
+  }
+
+  const char * parse_float( const char * p, const char * end, float & f, bool & ok ) {
+    static const double pow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+                                    1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+                                    1e21, 1e22 };
+    bool neg = p < end && *p == '-';
+    if( p < end && ( *p == '-' || *p == '+' ) ) {
+      p++;
+    }
+    const char * digits = p;
+    uint64_t mant = 0;
+    int exp = 0, kept = 0;
+    for( ; p < end && *p >= '0' && *p <= '9'; p++ ) {
+      if( kept < 19 ) {
+        mant = mant * 10 + ( *p - '0' );
+        kept += mant != 0;
+      } else {
+        exp++;
+      }
+    }
+    if( p < end && *p == '.' ) {
+      for( p++; p < end && *p >= '0' && *p <= '9'; p++ ) {
+        if( kept < 19 ) {
+          mant = mant * 10 + ( *p - '0' );
+          kept += mant != 0;
+          exp--;
+        }
+      }
+    }
+    ok = ok && p != digits;
+    if( p < end && ( *p == 'e' || *p == 'E' ) ) {
+      long e;
+      bool eok = true;
+      const char * q = parse_int( p + 1, end, e, eok );
+      if( eok ) {
+        exp += int( std::max( -400L, std::min( 400L, e ) ) );
+        p = q;
+      }
+    }
+    double d = double( mant );
+    while( exp > 22 ) {
+      d *= 1e22;
+      exp -= 22;
+    }
+    while( exp < -22 ) {
+      d /= 1e22;
+      exp += 22;
+    }
+    d = exp < 0 ? d / pow10[ -exp ] : d * pow10[ exp ];
+    f = float( neg ? -d : d );
+    return p;
+  }
+
+  // OBJ loading splits the mapped file into byte ranges with parallel_for,
+  // each owning the lines that start in it. A counting pass sizes every
+  // range, then a second pass parses straight into the presized vpos and
+  // faceVert, ranges placed by prefix sums of the counts.
+  struct ObjRange {
+    ObjRange() : verts( 0 ), faces( 0 ), corners( 0 ), ok( true ) {}
+    size_t verts, faces, corners;
+    bool ok;
+  };
+
+  struct ObjScan {
+    const char * data;
+    size_t size;
+    Model * m;                 // NULL for the counting pass
+    vector<ObjRange> * range;  // counts, then bases of each range
+    size_t totalVerts;
+    void operator()( size_t begin, size_t end, size_t thread ) {
+      const char * p = data + begin;
+      const char * e = data + size;
+      if( begin > 0 && p[-1] != '\n' ) {
+        p = next_line( p, e );
+      }
+      ObjRange & r = ( *range )[ thread ];
+      ObjRange n;
+      bool ok = true;
+      while( p < data + end ) {
+        p = skip_space( p, e );
+        if( p + 1 < e && p[0] == 'v' && is_space( p[1] ) ) {
+          if( m ) {
+            float xyz[3] = { 0, 0, 0 };
+            p += 2;
+            for( int k = 0; k < 3; k++ ) {
+              p = parse_float( skip_space( p, e ), e, xyz[k], ok );
+            }
+            m->vpos[ r.verts + n.verts ] = Vec3f( xyz[0], xyz[1], xyz[2] );
+          }
+          n.verts++;
+        } else if( p + 1 < e && p[0] == 'f' && is_space( p[1] ) ) {
+          p += 2;
+          size_t count = 0;
+          for( p = skip_space( p, e ); p < e && *p != '\n' && *p != '#'; p = skip_space( p, e ) ) {
+            if( m ) {
+              // v, v/t, v//n or v/t/n, negative counting back from this line
+              long v;
+              parse_int( p, e, v, ok );
+              long base = long( r.verts + n.verts );
+              v = v < 0 ? base + v : v - 1;
+              ok = ok && v >= 0 && size_t( v ) < totalVerts;
+              m->topo.faceVert.index[ r.corners + n.corners + count ] = Index( ok ? v : 0 );
+            }
+            count++;
+            p = skip_token( p, e );
+          }
+          if( m ) {
+            ok = ok && count > 2;
+            m->topo.faceVert.offset[ r.faces + n.faces + 1 ] = Index( r.corners + n.corners + count );
+          }
+          n.faces++;
+          n.corners += count;
+        }
+        p = next_line( p, e );
+      }
+      if( m ) {
+        r.ok = ok;
+      } else {
+        r = n;
+      }
+    }
+  };
+
+  // Derives the topology of a loaded cage, which must have faces, every
+  // one of at least 3 distinct verts, and manifold edges. Clears m if not.
+  bool derive_cage_topo( Model & m, const char * path ) {
+    if( m.topo.NumFaces() == 0 ) {
+      fprintf( stderr, "subdiv: no faces in %s\n", path );
+    } else if( ! derive_topo_from_face_verts( m.topo, m.vpos.size() ) ) {
+      fprintf( stderr, "subdiv: %s has a face of fewer than 3 or repeated verts, or a non-manifold edge\n", path );
+    } else {
+      return true;
+    }
+    m = Model();
+    return false;
+  }
+
+  // Loads the v and f records of an OBJ file as the cage m and derives
+  // its topology. Other records are skipped.
+  bool load_obj( const char * path, Model & m ) {
+    MappedFile file;
+    if( ! file.Open( path ) ) {
+      fprintf( stderr, "subdiv: cannot map %s\n", path );
+      return false;
+    }
+    size_t threads = worker_threads();
+    vector<ObjRange> range( parallel_chunks( file.size, threads ) );
+    ObjScan scan = { file.data, file.size, NULL, &range, 0 };
+    parallel_for( file.size, threads, scan );
+
+    // counts to bases
+    ObjRange total;
+    for( size_t t = 0; t < range.size(); t++ ) {
+      ObjRange c = range[t];
+      range[t] = total;
+      total.verts += c.verts;
+      total.faces += c.faces;
+      total.corners += c.corners;
+    }
+    if( ! fits_index( total.verts, total.faces, 0, total.corners ) ) {
+      fprintf( stderr, "subdiv: %s does not fit %d-bit indices, build with -DSUBDIV_INDEX64\n",
+               path, int( sizeof( Index ) * 8 ) );
+      return false;
+    }
+    m = Model();
+    m.vpos.resize( total.verts );
+    m.topo.faceVert.offset.resize( total.faces + 1 );
+    m.topo.faceVert.offset[0] = 0;
+    m.topo.faceVert.index.resize( total.corners );
+    scan.m = &m;
+    scan.totalVerts = total.verts;
+    parallel_for( file.size, threads, scan );
+    for( size_t t = 0; t < range.size(); t++ ) {
+      if( ! range[t].ok ) {
+        fprintf( stderr, "subdiv: bad vertex or face record in %s\n", path );
+        m = Model();
+        return false;
+      }
+    }
+    if( ! derive_cage_topo( m, path ) ) {
+      return false;
+    }
+    compute_normals( m );
+    return true;
+  }
+
+  // COLLADA loading
+  //
+  // Reads the first <mesh> of library_geometries: positions from the
+  // float_array behind the POSITION input of <vertices>, faces from every
+  // <polylist>, <polygons> and <triangles>, honoring the input offsets.
+  // Creases are not part of COLLADA, they are read from
+  //   <extra><technique profile="subdiv"><creases count="n">
+  // of the mesh as n triples of vertex, vertex, sharpness. Numeric text is
+  // scanned in place in the parsed document.
+
+  typedef tinyxml2::XMLElement XmlElement;
+
+  inline const char * skip_blank( const char * p, const char * end ) {
+    while( p < end && ( is_space( *p ) || *p == '\n' ) ) {
+      p++;
+    }
+    return p;
+  }
+
+  // The text of e as [begin,end), empty for a missing element.
+  const char * element_text( const XmlElement * e, const char * & end ) {
+    const char * text = e ? e->GetText() : NULL;
+    if( ! text ) {
+      text = "";
+    }
+    end = text + strlen( text );
+    return skip_blank( text, end );
+  }
+
+  size_t element_count( const XmlElement * e, const char * name ) {
+    const char * a = e ? e->Attribute( name ) : NULL;
+    return a ? size_t( strtoul( a, NULL, 10 ) ) : 0;
+  }
+
+  // The child of parent called name whose id is url, with or without '#'.
+  const XmlElement * find_by_id( const XmlElement * parent, const char * name, const char * url ) {
+    if( ! url ) {
+      return NULL;
+    }
+    url += *url == '#';
+    for( const XmlElement * e = parent->FirstChildElement( name ); e; e = e->NextSiblingElement( name ) ) {
+      const char * id = e->Attribute( "id" );
+      if( id && strcmp( id, url ) == 0 ) {
+        return e;
+      }
+    }
+    return NULL;
+  }
+
+  // The source of the input with the given semantic among the children of e.
+  const char * input_source( const XmlElement * e, const char * semantic, size_t * offset = NULL ) {
+    for( const XmlElement * in = e->FirstChildElement( "input" ); in; in = in->NextSiblingElement( "input" ) ) {
+      const char * s = in->Attribute( "semantic" );
+      if( s && strcmp( s, semantic ) == 0 ) {
+        if( offset ) {
+          *offset = element_count( in, "offset" );
+        }
+        return in->Attribute( "source" );
+      }
+    }
+    return NULL;
+  }
+
+  // Reads one primitive element into faceVert. Stride is the number of
+  // indices per corner, one past the largest input offset.
+  bool collada_faces( const XmlElement * prim, size_t nv, Topo & t ) {
+    size_t offset = 0, stride = 1;
+    if( ! input_source( prim, "VERTEX", &offset ) ) {
+      return false;
+    }
+    for( const XmlElement * in = prim->FirstChildElement( "input" ); in; in = in->NextSiblingElement( "input" ) ) {
+      stride = std::max( stride, element_count( in, "offset" ) + 1 );
+    }
+    bool poly = strcmp( prim->Name(), "polygons" ) == 0;
+    bool tris = strcmp( prim->Name(), "triangles" ) == 0;
+    const char * ce;
+    const char * c = element_text( prim->FirstChildElement( "vcount" ), ce );
+    size_t faces = element_count( prim, "count" );
+    const XmlElement * pe = prim->FirstChildElement( "p" );
+    const char * e;
+    const char * p = element_text( pe, e );
+    vector<Index> face;
+    bool ok = true;
+    for( size_t f = 0; ok && ( poly ? pe != NULL : f < faces ); f++ ) {
+      long n = 3;
+      if( poly ) {
+        // one <p> per face, its corners are whatever it holds
+        n = 0;
+        for( const char * q = p; q < e; q = skip_blank( skip_token( q, e ), e ) ) {
+          n++;
+        }
+        n /= long( stride );
+      } else if( ! tris ) {
+        c = skip_blank( parse_int( c, ce, n, ok ), ce );
+      }
+      face.clear();
+      for( long j = 0; ok && j < n; j++ ) {
+        for( size_t k = 0; k < stride; k++ ) {
+          long v;
+          p = skip_blank( parse_int( p, e, v, ok ), e );
+          if( k == offset ) {
+            ok = ok && v >= 0 && size_t( v ) < nv;
+            face.push_back( Index( v ) );
+          }
+        }
+      }
+      ok = ok && n > 2;
+      if( ok ) {
+        t.AddFace( &face[0], face.size() );
+      }
+      if( poly ) {
+        pe = pe->NextSiblingElement( "p" );
+        p = element_text( pe, e );
+      }
+    }
+    return ok;
+  }
+
+  // Loads a COLLADA mesh as the cage m and derives its topology.
+  bool load_collada( const char * path, Model & m ) {
+    MappedFile file;
+    if( ! file.Open( path ) ) {
+      fprintf( stderr, "subdiv: cannot map %s\n", path );
+      return false;
+    }
+    // no entities in numeric text, skip their translation
+    tinyxml2::XMLDocument doc( false );
+    if( doc.Parse( file.data, file.size ) != tinyxml2::XML_NO_ERROR ) {
+      fprintf( stderr, "subdiv: cannot parse %s\n", path );
+      return false;
+    }
+    file.Close();
+
+    const XmlElement * mesh = NULL;
+    const XmlElement * root = doc.FirstChildElement( "COLLADA" );
+    const XmlElement * lib = root ? root->FirstChildElement( "library_geometries" ) : NULL;
+    for( const XmlElement * g = lib ? lib->FirstChildElement( "geometry" ) : NULL; g && ! mesh;
+         g = g->NextSiblingElement( "geometry" ) ) {
+      mesh = g->FirstChildElement( "mesh" );
+    }
+    const XmlElement * verts = mesh ? mesh->FirstChildElement( "vertices" ) : NULL;
+    const XmlElement * src = verts ? find_by_id( mesh, "source", input_source( verts, "POSITION" ) ) : NULL;
+    const XmlElement * array = src ? src->FirstChildElement( "float_array" ) : NULL;
+    if( ! array ) {
+      fprintf( stderr, "subdiv: no mesh positions in %s\n", path );
+      return false;
+    }
+    const XmlElement * tech = src->FirstChildElement( "technique_common" );
+    const XmlElement * acc = tech ? tech->FirstChildElement( "accessor" ) : NULL;
+    size_t stride = acc && acc->Attribute( "stride" ) ? element_count( acc, "stride" ) : 3;
+    size_t floats = element_count( array, "count" );
+    if( stride == 0 || ! fits_index( floats / stride, 0, 0, 0 ) ) {
+      fprintf( stderr, "subdiv: bad position array in %s\n", path );
+      return false;
+    }
+
+    m = Model();
+    m.vpos.resize( floats / stride );
+    m.topo.faceVert.Clear();
+    const char * e;
+    const char * p = element_text( array, e );
+    bool ok = true;
+    for( size_t i = 0; i < m.vpos.size(); i++ ) {
+      float xyz[3] = { 0, 0, 0 };
+      for( size_t k = 0; k < stride; k++ ) {
+        float f;
+        p = skip_blank( parse_float( p, e, f, ok ), e );
+        if( k < 3 ) {
+          xyz[k] = f;
+        }
+      }
+      m.vpos[i] = Vec3f( xyz[0], xyz[1], xyz[2] );
+    }
+    for( const XmlElement * prim = mesh->FirstChildElement(); ok && prim; prim = prim->NextSiblingElement() ) {
+      const char * name = prim->Name();
+      if( strcmp( name, "polylist" ) == 0 || strcmp( name, "polygons" ) == 0 || strcmp( name, "triangles" ) == 0 ) {
+        ok = collada_faces( prim, m.vpos.size(), m.topo );
+      }
+    }
+    if( ! ok || ! fits_index( m.vpos.size(), m.topo.NumFaces(), 0, m.topo.faceVert.index.size() ) ) {
+      fprintf( stderr, "subdiv: bad position or face data in %s\n", path );
+      m = Model();
+      return false;
+    }
+    if( ! derive_cage_topo( m, path ) ) {
+      return false;
+    }
+
+    const XmlElement * extra = mesh->FirstChildElement( "extra" );
+    for( tech = extra ? extra->FirstChildElement( "technique" ) : NULL; tech; tech = tech->NextSiblingElement( "technique" ) ) {
+      const char * profile = tech->Attribute( "profile" );
+      if( profile && strcmp( profile, "subdiv" ) == 0 ) {
+        break;
+      }
+    }
+    const XmlElement * creases = tech ? tech->FirstChildElement( "creases" ) : NULL;
+    p = element_text( creases, e );
+    for( size_t i = 0; ok && i < element_count( creases, "count" ); i++ ) {
+      long v0, v1;
+      float sharpness;
+      p = skip_blank( parse_int( p, e, v0, ok ), e );
+      p = skip_blank( parse_int( p, e, v1, ok ), e );
+      p = skip_blank( parse_float( p, e, sharpness, ok ), e );
+      Edge * edge = ok && v0 >= 0 && v1 >= 0 ? m.topo.FindEdge( Index( v0 ), Index( v1 ) ) : NULL;
+      if( edge ) {
+        edge->crease = sharpness;
+      } else {
+        fprintf( stderr, "subdiv: ignoring crease %ld-%ld in %s, not an edge\n", v0, v1, path );
+      }
+    }
+    compute_normals( m );
+    return true;
+  }
+
+  // Picks the cage loader by file extension, OBJ unless .dae or .xml.
+  bool load_cage( const char * path, Model & m ) {
+    const char * ext = strrchr( path, '.' );
+    if( ext && ( strcasecmp( ext, ".dae" ) == 0 || strcasecmp( ext, ".xml" ) == 0 ) ) {
+      return load_collada( path, m );
+    }
+    return load_obj( path, m );
+  }
+
+  // Writes the positions, normals and faces of m as an OBJ file, decoding
+  // them when m is quantized.
+  bool save_obj( const char * path, const Model & m ) {
+    FILE * fp = fopen( path, "w" );
+    if( fp == NULL ) {
+      fprintf( stderr, "subdiv: cannot write %s\n", path );
+      return false;
+    }
+    if( m.quantized ) {
+      for( size_t i = 0; i < m.quant.Size(); i++ ) {
+        Vec3f p = m.quant.Position( i );
+        fprintf( fp, "v %.9g %.9g %.9g\n", p.x, p.y, p.z );
+      }
+      for( size_t i = 0; i < m.quant.Size(); i++ ) {
+        Vec3f n = m.quant.Normal( i );
+        fprintf( fp, "vn %.6g %.6g %.6g\n", n.x, n.y, n.z );
+      }
+    }
+    for( size_t i = 0; i < m.vpos.size(); i++ ) {
+      fprintf( fp, "v %.9g %.9g %.9g\n", m.vpos[i].x, m.vpos[i].y, m.vpos[i].z );
+    }
+    for( size_t i = 0; i < m.vnrm.size(); i++ ) {
+      fprintf( fp, "vn %.6g %.6g %.6g\n", m.vnrm[i].x, m.vnrm[i].y, m.vnrm[i].z );
+    }
+    bool normals = m.quantized || m.vnrm.size() == m.vpos.size();
+    const Topo & t = m.topo;
+    for( size_t i = 0; i < t.NumFaces(); i++ ) {
+      const Index * f = t.faceVert.Begin(i);
+      fputc( 'f', fp );
+      for( size_t j = 0; j < t.faceVert.Count(i); j++ ) {
+        unsigned long v = (unsigned long)f[j] + 1;
+        if( normals ) {
+          fprintf( fp, " %lu//%lu", v, v );
+        } else {
+          fprintf( fp, " %lu", v );
+        }
+      }
+      fputc( '\n', fp );
+    }
+    if( fclose( fp ) != 0 ) {
+      fprintf( stderr, "subdiv: cannot write %s\n", path );
+      return false;
+    }
+    return true;
+  }
+
+  // Level files
+  //
+  // A refined chain saved as flat arrays, to be mapped back later instead
+  // of refined again. The file is a LevelFileHeader, then per level a
+  // LevelHeader and its arrays in visit_level() order, each starting on a
+  // LevelAlign boundary. Arrays are stored native endian in their in-memory
+  // layout, so loading is bounds checks and one bulk copy per array; files
+  // of another version, byte order or index width are rejected. Control
+  // points are stored only where they differ from vpos, on limit surface
+  // levels, and are copied from vpos on load otherwise.
+  const uint32_t LevelFileVersion = 3;
+  const size_t LevelAlign = 16;
+  const size_t LevelArrays = 15;
+
+  struct LevelFileHeader {
+    char magic[8];        // "subdivlv"
+    uint32_t version;
+    uint32_t order;       // 0x01020304 as written
+    uint32_t indexBytes;
+    uint32_t edgeBytes;
+    uint64_t levels;
+  };
+
+  struct LevelHeader {
+    uint64_t level;
+    uint64_t count[ LevelArrays ];  // elements of each array
+  };
+
+  // Calls v on each array of m in file order, stopping at the first false.
+  template< class Visitor > bool visit_level( Model & m, Visitor & v ) {
+    Topo & t = m.topo;
+    return v( t.faceVert.offset ) && v( t.faceVert.index ) &&
+           v( t.faceEdge.offset ) && v( t.faceEdge.index ) &&
+           v( t.vertFace.offset ) && v( t.vertFace.index ) &&
+           v( t.vertEdge.offset ) && v( t.vertEdge.index ) &&
+           v( t.edge ) && v( m.vpos ) && v( m.vnrm ) && v( t.vertOrder ) &&
+           v( m.spos.x ) && v( m.spos.y ) && v( m.spos.z );
+  }
+
+  // Whether m.spos holds other points than m.vpos.
+  bool has_control_points( const Model & m ) {
+    if( m.spos.Size() != m.vpos.size() ) {
+      return m.spos.Size() != 0;
+    }
+    for( size_t i = 0; i < m.vpos.size(); i++ ) {
+      Vec3f p = m.spos.Get( i );
+      if( p.x != m.vpos[i].x || p.y != m.vpos[i].y || p.z != m.vpos[i].z ) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // True when the rows of c run from 0 up to its index size, each at least
+  // minCount long, and every entry is below bound.
+  bool level_csr_ok( const Csr & c, size_t minCount, uint64_t bound ) {
+    if( c.offset.empty() || c.offset[0] != 0 || c.offset.back() != c.index.size() ) {
+      return false;
+    }
+    for( size_t i = 0; i + 1 < c.offset.size(); i++ ) {
+      if( c.offset[ i + 1 ] < c.offset[i] || c.Count( i ) < minCount ) {
+        return false;
+      }
+    }
+    for( size_t i = 0; i < c.index.size(); i++ ) {
+      if( c.index[i] >= bound ) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Range checks of a loaded level, so that no kernel reads out of bounds.
+  bool level_topo_ok( const Topo & t ) {
+    uint64_t nf = t.NumFaces(), nv = t.NumVerts(), ne = t.edge.size();
+    if( ! level_csr_ok( t.faceVert, 3, nv ) || ! level_csr_ok( t.faceEdge, 3, ne ) ||
+        ! level_csr_ok( t.vertFace, 0, nf ) || ! level_csr_ok( t.vertEdge, 0, ne ) ||
+        t.faceEdge.offset != t.faceVert.offset ) {
+      return false;
+    }
+    for( size_t i = 0; i < t.edge.size(); i++ ) {
+      const Edge & e = t.edge[i];
+      if( e.v0 >= nv || e.v1 >= nv || ( e.f0 != InvalidIndex && e.f0 >= nf ) ||
+          ( e.f1 != InvalidIndex && e.f1 >= nf ) ) {
+        return false;
+      }
+    }
+    for( size_t i = 0; i < t.vertOrder.size(); i++ ) {
+      if( t.vertOrder[i] >= t.vertOrder.size() ) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  inline size_t level_padding( size_t bytes ) {
+    return ( LevelAlign - bytes % LevelAlign ) % LevelAlign;
+  }
+
+  struct LevelCount {
+    uint64_t * count;
+    template< class T > bool operator()( const vector<T> & a ) {
+      *count++ = a.size();
+      return true;
+    }
+  };
+
+  struct LevelWrite {
+    FILE * fp;
+    size_t bytes;      // written so far
+    bool Write( const void * data, size_t size ) {
+      static const char zero[ LevelAlign ] = { 0 };
+      size_t pad = level_padding( size );
+      bool ok = ( size == 0 || fwrite( data, size, 1, fp ) == 1 ) &&
+                ( pad == 0 || fwrite( zero, pad, 1, fp ) == 1 );
+      bytes += size + pad;
+      return ok;
+    }
+    template< class T > bool operator()( const vector<T> & a ) {
+      return Write( a.empty() ? NULL : &a[0], a.size() * sizeof( T ) );
+    }
+  };
+
+  struct LevelRead {
+    const char * p;
+    const char * end;
+    const uint64_t * count;
+    bool Read( const char * & data, uint64_t size ) {
+      if( uint64_t( end - p ) < size ) {
+        return false;
+      }
+      data = p;
+      p += size + std::min( uint64_t( end - p ) - size, uint64_t( level_padding( size ) ) );
+      return true;
+    }
+    template< class T > bool operator()( vector<T> & a ) {
+      uint64_t n = *count++;
+      const char * data;
+      if( n > uint64_t( end - p ) / sizeof( T ) || ! Read( data, n * sizeof( T ) ) ) {
+        return false;
+      }
+      const T * src = reinterpret_cast< const T * >( data );
+      a.assign( src, src + n );
+      return true;
+    }
+  };
+
+  bool level_header_ok( const LevelHeader & lh ) {
+    const uint64_t * c = lh.count;
+    uint64_t nf = c[0] - 1, nv = c[4] - 1;
+    return c[0] > 0 && c[2] == c[0] && c[4] > 0 && c[6] == c[4] &&
+           c[1] == c[3] && c[1] == c[5] && c[7] == 2 * c[8] &&
+           c[9] == nv && ( c[10] == 0 || c[10] == nv ) && ( c[11] == 0 || c[11] == nv ) &&
+           c[13] == c[12] && c[14] == c[12] && ( c[12] == 0 || c[12] == nv ) && fits_index( nv, nf, c[8], c[1] );
+  }
+
+  // Writes the chain from cage to the given level, refining or touching
+  // levels on the way, to path. The file appears under path only once it
+  // is complete.
+  bool save_levels( const char * path, Model & cage, size_t level ) {
+    vector<char> tmp( path, path + strlen( path ) );
+    const char * suffix = ".tmp";
+    tmp.insert( tmp.end(), suffix, suffix + strlen( suffix ) + 1 );
+    FILE * fp = fopen( &tmp[0], "wb" );
+    if( fp == NULL ) {
+      fprintf( stderr, "subdiv: cannot write %s\n", &tmp[0] );
+      return false;
+    }
+    LevelFileHeader fh;
+    memset( &fh, 0, sizeof( fh ) );
+    memcpy( fh.magic, "subdivlv", 8 );
+    fh.version = LevelFileVersion;
+    fh.order = 0x01020304;
+    fh.indexBytes = sizeof( Index );
+    fh.edgeBytes = sizeof( Edge );
+    fh.levels = level + 1;
+    LevelWrite w = { fp, 0 };
+    bool ok = w.Write( &fh, sizeof( fh ) );
+    Model * m = &cage;
+    for( size_t i = 0; ok && i <= level; i++ ) {
+      if( i > 0 ) {
+        if( m->next == NULL ) {
+          subdivide_model( *m );
+        }
+        m = m->next;
+        if( m == NULL ) {
+          ok = false;
+          break;
+        }
+      }
+      if( ! level_ok( touch_level( *m, true ), true ) ) {
+        ok = false;
+        break;
+      }
+      // spos equal to vpos is left out and rebuilt on load
+      bool control = has_control_points( *m );
+      if( ! control ) {
+        m->spos.Release();
+      }
+      LevelHeader lh;
+      memset( &lh, 0, sizeof( lh ) );
+      lh.level = m->level;
+      LevelCount lc = { lh.count };
+      visit_level( *m, lc );
+      ok = w.Write( &lh, sizeof( lh ) ) && visit_level( *m, w );
+      if( ! control ) {
+        to_soa( m->vpos, m->spos );
+      }
+    }
+    ok = fclose( fp ) == 0 && ok;
+    if( ! ok || rename( &tmp[0], path ) != 0 ) {
+      fprintf( stderr, "subdiv: cannot write %s\n", path );
+      remove( &tmp[0] );
+      return false;
+    }
+    return true;
+  }
+
+  // Replaces cage and its chain with the levels saved in path.
+  bool load_levels( const char * path, Model & cage ) {
+    MappedFile file;
+    if( ! file.Open( path ) ) {
+      fprintf( stderr, "subdiv: cannot map %s\n", path );
+      return false;
+    }
+    LevelFileHeader fh;
+    if( file.size < sizeof( fh ) ) {
+      fprintf( stderr, "subdiv: %s is not a level file\n", path );
+      return false;
+    }
+    memcpy( &fh, file.data, sizeof( fh ) );
+    if( memcmp( fh.magic, "subdivlv", 8 ) != 0 || fh.version != LevelFileVersion || fh.order != 0x01020304 ) {
+      fprintf( stderr, "subdiv: %s is not a version %d level file\n", path, int( LevelFileVersion ) );
+      return false;
+    }
+    if( fh.indexBytes != sizeof( Index ) || fh.edgeBytes != sizeof( Edge ) ) {
+      fprintf( stderr, "subdiv: %s has %d-bit indices, this build %d-bit\n", path,
+               int( fh.indexBytes * 8 ), int( sizeof( Index ) * 8 ) );
+      return false;
+    }
+    delete cage.next;
+    cage = Model();
+    LevelRead r = { file.data + sizeof( fh ), file.data + file.size, NULL };
+    Model * m = &cage;
+    bool ok = fh.levels > 0;
+    for( uint64_t i = 0; ok && i < fh.levels; i++ ) {
+      const char * data;
+      LevelHeader lh;
+      ok = r.Read( data, sizeof( lh ) );
+      if( ok ) {
+        memcpy( &lh, data, sizeof( lh ) );
+        ok = lh.level == i && level_header_ok( lh );
+      }
+      if( ok && i > 0 ) {
+        m->next = new Model();
+        m->next->prev = m;
+        m->next->level = m->level + 1;
+        m = m->next;
+      }
+      r.count = lh.count;
+      ok = ok && visit_level( *m, r ) && level_topo_ok( m->topo );
+      if( ok ) {
+        m->topo.reordered = ! m->topo.vertOrder.empty();
+        if( m->spos.Size() == 0 ) {
+          to_soa( m->vpos, m->spos );
+        }
+        if( m->vnrm.empty() ) {
+          compute_normals( *m );
+        }
+        m->topo.stamp = next_stamp();
+        m->stamp = next_stamp();
+      }
+    }
+    if( ! ok ) {
+      fprintf( stderr, "subdiv: %s is truncated or corrupt\n", path );
+      delete cage.next;
+      cage = Model();
+      return false;
+    }
+    return true;
+  }
+
+  // Feature-adaptive refinement
+  //
+  // A quad whose corners are smooth, interior and of valence 4 with only
+  // quads around them is a bicubic B-spline patch on its 16 point one-ring,
+  // and Catmull-Clark on it is B-spline knot insertion. Such faces are kept
+  // as patches and tessellated on demand, only the rest is refined further.
+
+  // A patch face of some refined level and its control points, row-major,
+  // with the face itself spanning points 5, 6, 10, 9.
+  struct Patch {
+    const Model * m;
+    size_t level;
+    Index cv[16];
+  };
+
+  // The result of adaptive_refine(). Levels holds the refined neighborhood
+  // of the irregular faces at each level, the faces refined all the way
+  // are the leading finestFaces faces of finest.
+  struct AdaptiveModel {
+    AdaptiveModel() : finest( NULL ), finestFaces( 0 ), level( 0 ) {}
+    ~AdaptiveModel() {
+      Clear();
+    }
+    void Clear() {
+      for( size_t i = 0; i < levels.size(); i++ ) {
+        delete levels[i];
+      }
+      levels.clear();
+      patch.clear();
+      finest = NULL;
+      finestFaces = 0;
+      level = 0;
+    }
+    size_t NumFaces() const {
+      return patch.size() + finestFaces;
+    }
+    vector<Model *> levels;
+    vector<Patch> patch;
+    const Model * finest;
+    size_t finestFaces;
+    size_t level;
+  private:
+    AdaptiveModel( const AdaptiveModel & );
+    AdaptiveModel & operator=( const AdaptiveModel & );
+  };
+
+  bool regular_face( const Topo & t, size_t f ) {
+    if( t.faceVert.Count(f) != 4 ) {
+      return false;
+    }
+    const Index * q = t.faceVert.Begin(f);
+    for( size_t j = 0; j < 4; j++ ) {
+      Index u = q[j];
+      if( t.vertEdge.Count(u) != 4 || t.vertFace.Count(u) != 4 ) {
+        return false;
+      }
+      for( size_t k = 0; k < 4; k++ ) {
+        if( t.edge[ t.vertEdge.Begin(u)[k] ].crease > 0.0f ||
+            t.faceVert.Count( t.vertFace.Begin(u)[k] ) != 4 ) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  // Gathers the 16 control points of regular face f.
+  void gather_patch( const Topo & t, size_t f, Index cv[16] ) {
+    const Index * q = t.faceVert.Begin(f);
+    const Index * fe = t.faceEdge.Begin(f);
+    // grid slots of the face corners, and of the two outer points across
+    // each face edge, nearest the edge start first
+    static const int inner[4] = { 5, 6, 10, 9 };
+    static const int across[4][2] = { { 1, 2 }, { 7, 11 }, { 14, 13 }, { 8, 4 } };
+    static const int diagonal[4] = { 0, 3, 15, 12 };
+    for( size_t j = 0; j < 4; j++ ) {
+      cv[ inner[j] ] = q[j];
+    }
+    for( size_t j = 0; j < 4; j++ ) {
+      // the neighbor runs the shared edge backwards: q[j+1], q[j], x, y
+      const Edge & e = t.edge[ fe[j] ];
+      size_t nb = e.f0 == f ? e.f1 : e.f0;
+      const Index * n = t.faceVert.Begin( nb );
+      size_t k = corner_of( t, nb, q[j] );
+      cv[ across[j][0] ] = n[ ( k + 1 ) % 4 ];
+      cv[ across[j][1] ] = n[ ( k + 2 ) % 4 ];
+    }
+    for( size_t j = 0; j < 4; j++ ) {
+      // the face at q[j] sharing no edge with f
+      const Index * vf = t.vertFace.Begin( q[j] );
+      for( size_t k = 0; k < 4; k++ ) {
+        const Index * n = t.faceVert.Begin( vf[k] );
+        size_t c = corner_of( t, vf[k], q[j] );
+        Index a = n[ ( c + 1 ) % 4 ], b = n[ ( c + 3 ) % 4 ];
+        Index qn = q[ ( j + 1 ) % 4 ], qp = q[ ( j + 3 ) % 4 ];
+        if( a != qn && a != qp && b != qn && b != qp ) {
+          cv[ diagonal[j] ] = n[ ( c + 2 ) % 4 ];
+        }
+      }
+    }
+  }
+
+  // Copies faces s of m and the faces sharing a vertex with them into r,
+  // s first and in order, with positions and creases. in and remap are
+  // scratch sized to the faces and verts of m, all 0 and InvalidIndex on
+  // entry, and left that way, so tiles can share them across calls.
+  void extract_ring( const Model & m, const vector<size_t> & s, Model & r,
+                     vector<char> & in, vector<Index> & remap, vector<size_t> & faces ) {
+    const Topo & t = m.topo;
+    faces.assign( s.begin(), s.end() );
+    for( size_t i = 0; i < s.size(); i++ ) {
+      in[ s[i] ] = 1;
+    }
+    for( size_t i = 0; i < s.size(); i++ ) {
+      const Index * q = t.faceVert.Begin( s[i] );
+      for( size_t j = 0; j < t.faceVert.Count( s[i] ); j++ ) {
+        const Index * vf = t.vertFace.Begin( q[j] );
+        for( size_t k = 0; k < t.vertFace.Count( q[j] ); k++ ) {
+          if( ! in[ vf[k] ] ) {
+            in[ vf[k] ] = 1;
+            faces.push_back( vf[k] );
+          }
+        }
+      }
+    }
+    r.vpos.clear();
+    r.topo.faceVert.Clear();
+    for( size_t i = 0; i < faces.size(); i++ ) {
+      const Index * q = t.faceVert.Begin( faces[i] );
+      size_t fv = t.faceVert.Count( faces[i] );
+      for( size_t j = 0; j < fv; j++ ) {
+        if( remap[ q[j] ] == InvalidIndex ) {
+          remap[ q[j] ] = Index( r.vpos.size() );
+          r.vpos.push_back( m.vpos[ q[j] ] );
+        }
+        r.topo.faceVert.index.push_back( remap[ q[j] ] );
+      }
+      r.topo.faceVert.offset.push_back( Index( r.topo.faceVert.index.size() ) );
+    }
+    derive_topo_from_face_verts( r.topo, r.vpos.size() );
+    for( size_t i = 0; i < faces.size(); i++ ) {
+      const Index * q = t.faceVert.Begin( faces[i] );
+      const Index * fe = t.faceEdge.Begin( faces[i] );
+      const Index * rfe = r.topo.faceEdge.Begin(i);
+      for( size_t j = 0; j < t.faceEdge.Count( faces[i] ); j++ ) {
+        r.topo.edge[ rfe[j] ].crease = t.edge[ fe[j] ].crease;
+        remap[ q[j] ] = InvalidIndex;
+      }
+      in[ faces[i] ] = 0;
+    }
+  }
+
+  Model * extract_ring( const Model & m, const vector<size_t> & s ) {
+    vector<char> in( m.topo.NumFaces(), 0 );
+    vector<Index> remap( m.topo.NumVerts(), InvalidIndex );
+    vector<size_t> faces;
+    Model * r = new Model();
+    extract_ring( m, s, *r, in, remap, faces );
+    return r;
+  }
+
+  // Refines cage to level, splitting every face below uniformLevels and
+  // after that only faces that are not regular_face(). Regular faces are
+  // left as patches. Children of a split face only depend on its vertex
+  // one-ring, so each level splits just that ring, copied out of the last.
+  void adaptive_refine( const Model & cage, size_t level, size_t uniformLevels, AdaptiveModel & am ) {
+    am.Clear();
+    am.level = level;
+    const Model * cur = &cage;
+    size_t candidates = cage.topo.NumFaces();
+    for( size_t l = 0; l < level; l++ ) {
+      const Topo & t = cur->topo;
+      vector<size_t> s;
+      for( size_t i = 0; i < candidates; i++ ) {
+        if( l < uniformLevels || ! regular_face( t, i ) ) {
+          s.push_back( i );
+        } else {
+          Patch p;
+          p.m = cur;
+          p.level = l;
+          gather_patch( t, i, p.cv );
+          am.patch.push_back( p );
+        }
+      }
+      candidates = 0;
+      if( s.empty() ) {
+        break;
+      }
+      Model * x = extract_ring( *cur, s );
+      am.levels.push_back( x );
+      split_model( *x );
+      if( x->next == NULL ) {
+        break;
+      }
+      average( *x->next );
+      x->next->level = l + 1;
+      cur = x->next;
+      candidates = x->topo.faceVert.offset[ s.size() ];
+    }
+    if( candidates && cur != &cage ) {
+      compute_normals( *am.levels.back()->next );
+    }
+    am.finest = candidates ? cur : NULL;
+    am.finestFaces = candidates;
+  }
+
+  // One step of cubic B-spline subdivision along a row or column of n
+  // points spaced stride apart: edge points land at even, vertex points at
+  // odd slots of the 2n-3 results.
+  void bspline_split( const Vec3f * g, size_t n, size_t stride, Vec3f * out, size_t ostride ) {
+    for( size_t j = 0; j + 1 < n; j++ ) {
+      out[ 2 * j * ostride ] = ( g[ j * stride ] + g[ ( j + 1 ) * stride ] ) * 0.5f;
+    }
+    for( size_t j = 1; j + 1 < n; j++ ) {
+      out[ ( 2 * j - 1 ) * ostride ] = ( g[ ( j - 1 ) * stride ] + g[ j * stride ] * 6.0f + g[ ( j + 1 ) * stride ] ) * 0.125f;
+    }
+  }
+
+  // Positions and normals of the ( 2^depth + 1 )^2 points of a patch after
+  // depth more levels, row-major. They are the points uniform refinement
+  // puts there, so patches meet refined faces without cracks.
+  void tessellate_patch( const Patch & p, size_t depth, vector<Vec3f> & pos, vector<Vec3f> & nrm ) {
+    size_t n = 4;
+    vector<Vec3f> g( 16 ), row;
+    for( size_t i = 0; i < 16; i++ ) {
+      g[i] = p.m->vpos[ p.cv[i] ];
+    }
+    for( size_t d = 0; d < depth; d++ ) {
+      size_t m = 2 * n - 3;
+      row.resize( n * m );
+      for( size_t r = 0; r < n; r++ ) {
+        bspline_split( &g[ r * n ], n, 1, &row[ r * m ], 1 );
+      }
+      g.resize( m * m );
+      for( size_t c = 0; c < m; c++ ) {
+        bspline_split( &row[c], n, m, &g[c], m );
+      }
+      n = m;
+    }
+    // area-weighted normals of every cell, as in face_normals, then vertex
+    // normals of the inner points
+    size_t cells = n - 1;
+    vector<Vec3f> fn( cells * cells );
+    for( size_t r = 0; r < cells; r++ ) {
+      for( size_t c = 0; c < cells; c++ ) {
+        Vec3f d0 = g[ ( r + 1 ) * n + c + 1 ] - g[ r * n + c ];
+        Vec3f d1 = g[ ( r + 1 ) * n + c ] - g[ r * n + c + 1 ];
+        fn[ r * cells + c ] = d0.Cross( d1 );
+      }
+    }
+    size_t side = n - 2;
+    pos.resize( side * side );
+    nrm.resize( side * side );
+    for( size_t r = 0; r < side; r++ ) {
+      for( size_t c = 0; c < side; c++ ) {
+        Vec3f s = fn[ r * cells + c ] + fn[ r * cells + c + 1 ] +
+                  fn[ ( r + 1 ) * cells + c ] + fn[ ( r + 1 ) * cells + c + 1 ];
+        s.Normalize();
+        pos[ r * side + c ] = g[ ( r + 1 ) * n + c + 1 ];
+        nrm[ r * side + c ] = s;
+      }
+    }
+  }
+
+  // Flat arrays of a whole adaptive refinement, as build_draw_vertices()
+  // and build_draw_indices() give for a level: the faces of its finest
+  // level, then every patch tessellated to am.level as a grid of triangle
+  // pairs. No lines.
+  void build_adaptive_draw( const AdaptiveModel & am, DrawArrays & da ) {
+    da.vertex.clear();
+    da.tris.clear();
+    da.lines.clear();
+    if( am.finest ) {
+      build_draw_vertices( *am.finest, da );
+      const Topo & t = am.finest->topo;
+      for( size_t i = 0; i < am.finestFaces; i++ ) {
+        const Index * f = t.faceVert.Begin(i);
+        for( size_t j = 1; j + 1 < t.faceVert.Count(i); j++ ) {
+          da.tris.push_back( uint32_t( f[0] ) );
+          da.tris.push_back( uint32_t( f[j] ) );
+          da.tris.push_back( uint32_t( f[ j + 1 ] ) );
+        }
+      }
+    }
+    vector<Vec3f> pos, nrm;
+    for( size_t i = 0; i < am.patch.size(); i++ ) {
+      const Patch & p = am.patch[i];
+      tessellate_patch( p, am.level - p.level, pos, nrm );
+      size_t side = ( size_t( 1 ) << ( am.level - p.level ) ) + 1;
+      uint32_t base = uint32_t( da.vertex.size() / 6 );
+      for( size_t j = 0; j < pos.size(); j++ ) {
+        float v[6] = { pos[j].x, pos[j].y, pos[j].z, nrm[j].x, nrm[j].y, nrm[j].z };
+        da.vertex.insert( da.vertex.end(), v, v + 6 );
+      }
+      // wound as the strips of rows r and r + 1 were
+      for( size_t r = 0; r + 1 < side; r++ ) {
+        for( size_t c = 0; c + 1 < side; c++ ) {
+          uint32_t a0 = base + uint32_t( ( r + 1 ) * side + c ), b0 = base + uint32_t( r * side + c );
+          uint32_t q[6] = { a0, b0, a0 + 1, a0 + 1, b0, b0 + 1 };
+          da.tris.insert( da.tris.end(), q, q + 6 );
+        }
+      }
+    }
+  }
+
+  // View-dependent level of detail
+
+  // Faces of a refined level descended from face i of the cage are
+  // [begin,end): level 1 keeps the parent order and splits into quads only.
+  void descendant_faces( const Topo & cage, size_t i, size_t level, size_t & begin, size_t & end ) {
+    begin = i;
+    end = i + 1;
+    if( level > 0 ) {
+      size_t scale = size_t( 1 ) << ( 2 * ( level - 1 ) );
+      begin = cage.faceVert.offset[i] * scale;
+      end = cage.faceVert.offset[ i + 1 ] * scale;
+    }
+  }
+
+  // Picks the level of each cage face that brings its longest edge down to
+  // about pixels on a width x height viewport, clamped to maxLevel, with
+  // mvp the column-major clip matrix. Faces are culled to -1 when all of
+  // their vertex one-ring, whose hull holds the limit patch, is outside
+  // one frustum plane.
+  void select_lod( const Model & cage, const float mvp[16], float width, float height,
+                   float pixels, int maxLevel, vector<int> & lod ) {
+    const Topo & t = cage.topo;
+    size_t nv = cage.vpos.size();
+    vector<float> clip( nv * 4 );
+    vector<unsigned char> outside( nv );
+    for( size_t i = 0; i < nv; i++ ) {
+      const Vec3f & p = cage.vpos[i];
+      float * c = &clip[ i * 4 ];
+      for( int r = 0; r < 4; r++ ) {
+        c[r] = mvp[r] * p.x + mvp[ 4 + r ] * p.y + mvp[ 8 + r ] * p.z + mvp[ 12 + r ];
+      }
+      outside[i] = ( c[0] < -c[3] ? 1 : 0 ) | ( c[0] > c[3] ? 2 : 0 ) |
+                   ( c[1] < -c[3] ? 4 : 0 ) | ( c[1] > c[3] ? 8 : 0 ) |
+                   ( c[2] < -c[3] ? 16 : 0 ) | ( c[2] > c[3] ? 32 : 0 );
+    }
+    lod.resize( t.NumFaces() );
+    for( size_t i = 0; i < t.NumFaces(); i++ ) {
+      const Index * q = t.faceVert.Begin(i);
+      size_t fv = t.faceVert.Count(i);
+      unsigned char all = 63;
+      for( size_t j = 0; j < fv; j++ ) {
+        const Index * vf = t.vertFace.Begin( q[j] );
+        for( size_t k = 0; k < t.vertFace.Count( q[j] ); k++ ) {
+          const Index * n = t.faceVert.Begin( vf[k] );
+          for( size_t l = 0; l < t.faceVert.Count( vf[k] ); l++ ) {
+            all &= outside[ n[l] ];
+          }
+        }
+      }
+      if( all ) {
+        lod[i] = -1;
+        continue;
+      }
+      float longest = 0.0f;
+      bool behind = false;
+      for( size_t j = 0; j < fv; j++ ) {
+        const float * c0 = &clip[ q[j] * 4 ];
+        const float * c1 = &clip[ q[ ( j + 1 ) % fv ] * 4 ];
+        if( c0[3] <= 0.0f || c1[3] <= 0.0f ) {
+          behind = true;
+          break;
+        }
+        float dx = ( c0[0] / c0[3] - c1[0] / c1[3] ) * 0.5f * width;
+        float dy = ( c0[1] / c0[3] - c1[1] / c1[3] ) * 0.5f * height;
+        longest = max( longest, dx * dx + dy * dy );
+      }
+      int level = 0;
+      if( behind ) {
+        level = maxLevel;
+      } else {
+        // each level halves the edges, so quarters their squared length
+        float target = pixels * pixels;
+        while( level < maxLevel && longest > target ) {
+          longest *= 0.25f;
+          level++;
+        }
+      }
+      lod[i] = level;
+    }
+  }
+
+  // Raises drawn faces until the faces around each cage vert are at most
+  // one level apart, so the finer side of every seam can be snapped onto
+  // the coarser one, see refine_features().
+  void limit_lod_steps( const Topo & cage, vector<int> & lod ) {
+    vector<int> around( cage.NumVerts() );
+    for( bool raised = true; raised; ) {
+      raised = false;
+      fill( around.begin(), around.end(), -1 );
+      for( size_t i = 0; i < cage.NumFaces(); i++ ) {
+        const Index * q = cage.faceVert.Begin(i);
+        for( size_t j = 0; j < cage.faceVert.Count(i); j++ ) {
+          around[ q[j] ] = max( around[ q[j] ], lod[i] );
+        }
+      }
+      for( size_t i = 0; i < cage.NumFaces(); i++ ) {
+        const Index * q = cage.faceVert.Begin(i);
+        for( size_t j = 0; j < cage.faceVert.Count(i) && lod[i] >= 0; j++ ) {
+          if( around[ q[j] ] - 1 > lod[i] ) {
+            lod[i] = around[ q[j] ] - 1;
+            raised = true;
+          }
+        }
+      }
+    }
+  }
+
+  // Where the verts of a refined level sit on the cage. feature is the cage
+  // vert a vert descends from, the cage's vert count plus the cage edge it
+  // lies on, or InvalidIndex inside a cage face. parent holds two verts of
+  // the coarser level per vert: the ends of the edge it was split from, or
+  // the vert it was averaged from twice. A face drawn next to a coarser one
+  // snaps the verts on their seam to the midpoints of their parents, which
+  // lie on the coarser side's edges, closing the T-junction cracks.
+  struct CageFeatures {
+    vector<Index> feature;
+    vector<Index> parent;
+  };
+
+  // Fills out for t, split from coarse, whose features are cf, or empty when
+  // coarse is the cage. False when t was reordered and has dropped the order.
+  bool refine_features( const Topo & coarse, const CageFeatures & cf, size_t cageVerts,
+                        const Topo & t, CageFeatures & out ) {
+    size_t pv = cf.feature.empty() ? cageVerts : cf.feature.size();
+    size_t pf = coarse.NumFaces();
+    size_t slots = pv + pf + coarse.edge.size();
+    const vector<Index> & order = t.vertOrder;
+    if( t.reordered && order.size() != slots ) {
+      return false;
+    }
+    out.feature.assign( slots, InvalidIndex );
+    out.parent.assign( 2 * slots, InvalidIndex );
+    for( size_t s = 0; s < pv; s++ ) {
+      size_t v = order.empty() ? s : order[s];
+      out.feature[v] = cf.feature.empty() ? Index( s ) : cf.feature[s];
+      out.parent[ 2 * v ] = out.parent[ 2 * v + 1 ] = Index( s );
+    }
+    for( size_t e = 0; e < coarse.edge.size(); e++ ) {
+      const Edge & ce = coarse.edge[e];
+      Index fa = cf.feature.empty() ? ce.v0 : cf.feature[ ce.v0 ];
+      Index fb = cf.feature.empty() ? ce.v1 : cf.feature[ ce.v1 ];
+      if( fa == InvalidIndex || fb == InvalidIndex ) {
+        continue;
+      }
+      // split from the cage, edge e is cage edge e; past it an edge on a
+      // cage edge runs from a vert on it to another or to one of its ends
+      Index f = InvalidIndex;
+      if( cf.feature.empty() ) {
+        f = Index( cageVerts + e );
+      } else if( fa >= cageVerts && ( fb == fa || fb < cageVerts ) ) {
+        f = fa;
+      } else if( fb >= cageVerts && fa < cageVerts ) {
+        f = fb;
+      }
+      size_t s = pv + pf + e;
+      size_t v = order.empty() ? s : order[s];
+      out.feature[v] = f;
+      out.parent[ 2 * v ] = ce.v0;
+      out.parent[ 2 * v + 1 ] = ce.v1;
+    }
+    return true;
+  }
+
+
+  // Tiled refinement
+  //
+  // Refines each cage face on its own, depth first: its one-ring is copied
+  // out and split, then the ring of its children is, and so on down to the
+  // level, as adaptive_refine() does for irregular faces. Children depend
+  // only on that ring, so tiles match uniform refinement, while the scratch
+  // levels of a tile stay small enough to be cache resident. Tiles go to
+  // offsets known up front, so they are refined in parallel. Streamed to a
+  // sink, only one batch of tiles is held at a time, never the whole of
+  // the finest level.
+  struct TiledModel {
+    TiledModel() : level( 0 ), faceBegin( 0 ), faceEnd( 0 ) {}
+    vector<Vec3f> vpos;
+    vector<Vec3f> vnrm;
+    vector<Index> quads;      // 4 verts per face, into all the tiles' verts
+    vector<size_t> tileVert;  // first vert and face of the tile of each cage face
+    vector<size_t> tileFace;
+    size_t level;
+    // the tiles held are those of cage faces faceBegin to faceEnd, so
+    // vpos[0] is vert tileVert[ faceBegin ] of the whole
+    size_t faceBegin, faceEnd;
+  };
+
+  // Verts in a batch of tiles streamed by tiled_refine(), at least one tile.
+  size_t tileBatch = size_t( 1 ) << 20;
+
+  // Per-thread scratch: the ring copied out at each level and its split.
+  struct TileScratch {
+    TileScratch() : badTile( NoTile ) {}
+    static const size_t NoTile = ~size_t( 0 );
+    vector<Model> ring;
+    vector<Model> split;
+    vector<char> in;
+    vector<Index> remap;
+    vector<Index> local;      // split vert to tile vert
+    vector<size_t> s, faces;
+    size_t badTile;           // a cage face whose tile broke its layout, or none
+  };
+
+  // Refines cage face f to tm.level in ts and writes its tile into tm.
+  // False, with the tile's faces left unwritten, when the refined tile does
+  // not have the verts and faces its layout reserves.
+  bool refine_tile( const Model & cage, size_t f, TileScratch & ts, TiledModel & tm ) {
+    const Model * cur = &cage;
+    ts.s.assign( 1, f );
+    for( size_t l = 0; l < tm.level; l++ ) {
+      Model & x = ts.ring[l];
+      Model & y = ts.split[l];
+      if( ts.in.size() < cur->topo.NumFaces() ) {
+        ts.in.resize( cur->topo.NumFaces(), 0 );
+      }
+      if( ts.remap.size() < cur->topo.NumVerts() ) {
+        ts.remap.resize( cur->topo.NumVerts(), InvalidIndex );
+      }
+      extract_ring( *cur, ts.s, x, ts.in, ts.remap, ts.faces );
+      y.prev = &x;
+      y.level = l + 1;
+      split_topo( x.topo, y.topo, false );
+      average( y );
+      ts.s.resize( x.topo.faceVert.offset[ ts.s.size() ] );
+      for( size_t i = 0; i < ts.s.size(); i++ ) {
+        ts.s[i] = i;
+      }
+      cur = &y;
+    }
+    Model & y = ts.split[ tm.level - 1 ];
+    finish_level( y );
+
+    // tile verts in order of first use by the tile's faces
+    size_t vb = tm.tileVert[f], fb = tm.tileFace[f];
+    size_t tileVerts = tm.tileVert[ f + 1 ] - vb;
+    size_t vo = vb - tm.tileVert[ tm.faceBegin ], fo = fb - tm.tileFace[ tm.faceBegin ];
+    if( ts.s.size() != tm.tileFace[ f + 1 ] - fb ) {
+      return false;
+    }
+    ts.local.assign( y.vpos.size(), InvalidIndex );
+    size_t nv = 0;
+    for( size_t i = 0; i < ts.s.size(); i++ ) {
+      const Index * q = y.topo.faceVert.Begin(i);
+      for( size_t j = 0; j < 4; j++ ) {
+        if( ts.local[ q[j] ] == InvalidIndex ) {
+          if( nv == tileVerts ) {
+            return false;
+          }
+          ts.local[ q[j] ] = Index( nv );
+          tm.vpos[ vo + nv ] = y.vpos[ q[j] ];
+          tm.vnrm[ vo + nv ] = y.vnrm[ q[j] ];
+          nv++;
+        }
+      }
+    }
+    if( nv != tileVerts ) {
+      return false;
+    }
+    for( size_t i = 0; i < ts.s.size(); i++ ) {
+      const Index * q = y.topo.faceVert.Begin(i);
+      for( size_t j = 0; j < 4; j++ ) {
+        tm.quads[ 4 * ( fo + i ) + j ] = Index( vb + ts.local[ q[j] ] );
+      }
+    }
+    return true;
+  }
+
+  struct TileRefine {
+    const Model * cage;
+    TiledModel * tm;
+    vector<TileScratch> * scratch;
+    void operator()( size_t begin, size_t end, size_t thread ) {
+      TileScratch & ts = ( *scratch )[ thread ];
+      for( size_t f = tm->faceBegin + begin; f < tm->faceBegin + end; f++ ) {
+        if( ! refine_tile( *cage, f, ts, *tm ) ) {
+          ts.badTile = f;
+        }
+      }
+    }
+  };
+
+  // Lays out the tiles of cage at level, at least 1, in tm and sizes the
+  // per-thread scratch. An n-sided face has n m x m quads, m = 2^( level - 1 ),
+  // on n m^2 + n m + 1 verts; verts on cage edges appear once in each tile
+  // that shares them.
+  bool tiled_layout( const Model & cage, size_t level, TiledModel & tm, vector<TileScratch> & scratch ) {
+    if( level == 0 ) {
+      fprintf( stderr, "subdiv: tiled refinement needs a level of at least 1\n" );
+      return false;
+    }
+    const Topo & t = cage.topo;
+    size_t nf = t.NumFaces();
+    uint64_t m = uint64_t( 1 ) << ( level - 1 );
+    vector<uint64_t> tileVert( nf + 1, 0 ), tileFace( nf + 1, 0 );
+    for( size_t i = 0; i < nf; i++ ) {
+      uint64_t n = t.faceVert.Count(i);
+      tileFace[ i + 1 ] = tileFace[i] + n * m * m;
+      tileVert[ i + 1 ] = tileVert[i] + n * m * m + n * m + 1;
+    }
+    if( ! fits_index( tileVert[ nf ], tileFace[ nf ], 0, 4 * tileFace[ nf ] ) ) {
+      fprintf( stderr, "subdiv: level %d does not fit %d-bit indices, build with -DSUBDIV_INDEX64\n",
+               int( level ), int( sizeof( Index ) * 8 ) );
+      return false;
+    }
+    tm.level = level;
+    tm.tileVert.assign( tileVert.begin(), tileVert.end() );
+    tm.tileFace.assign( tileFace.begin(), tileFace.end() );
+    tm.faceBegin = tm.faceEnd = 0;
+    scratch.resize( parallel_chunks( nf, worker_threads(), 1 ) );
+    for( size_t i = 0; i < scratch.size(); i++ ) {
+      scratch[i].ring.resize( level );
+      scratch[i].split.resize( level );
+    }
+    return true;
+  }
+
+  // Refines the tiles of cage faces begin to end into tm, in parallel.
+  // False when a tile does not match its layout.
+  bool refine_tiles( const Model & cage, size_t begin, size_t end, vector<TileScratch> & scratch, TiledModel & tm ) {
+    tm.faceBegin = begin;
+    tm.faceEnd = end;
+    tm.vpos.resize( tm.tileVert[ end ] - tm.tileVert[ begin ] );
+    tm.vnrm.resize( tm.vpos.size() );
+    tm.quads.resize( 4 * ( tm.tileFace[ end ] - tm.tileFace[ begin ] ) );
+    for( size_t i = 0; i < scratch.size(); i++ ) {
+      scratch[i].badTile = TileScratch::NoTile;
+    }
+    TileRefine tr = { &cage, &tm, &scratch };
+    parallel_for( end - begin, worker_threads(), tr, 1 );
+    for( size_t i = 0; i < scratch.size(); i++ ) {
+      if( scratch[i].badTile != TileScratch::NoTile ) {
+        fprintf( stderr, "subdiv: the tile of cage face %d does not match its layout\n", int( scratch[i].badTile ) );
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Refines cage to level, at least 1, holding all of its tiles in tm.
+  bool tiled_refine( const Model & cage, size_t level, TiledModel & tm ) {
+    vector<TileScratch> scratch;
+    return tiled_layout( cage, level, tm, scratch ) &&
+           refine_tiles( cage, 0, cage.topo.NumFaces(), scratch, tm );
+  }
+
+  // Refines cage to level in batches of consecutive tiles of about
+  // tileBatch verts, calling sink( tm ) on each in cage face order. Stops
+  // when the sink returns false.
+  template< class Sink > bool tiled_refine( const Model & cage, size_t level, TiledModel & tm, Sink & sink ) {
+    vector<TileScratch> scratch;
+    if( ! tiled_layout( cage, level, tm, scratch ) ) {
+      return false;
+    }
+    size_t nf = cage.topo.NumFaces();
+    for( size_t begin = 0; begin < nf; ) {
+      size_t end = begin + 1;
+      while( end < nf && tm.tileVert[ end + 1 ] - tm.tileVert[ begin ] <= tileBatch ) {
+        end++;
+      }
+      if( ! refine_tiles( cage, begin, end, scratch, tm ) || ! sink( tm ) ) {
+        return false;
+      }
+      begin = end;
+    }
+    return true;
+  }
+
+  // Verts of the given level of the uniform refinement of cage, from the
+  // counts alone: each split adds a vert per face and per edge.
+  uint64_t uniform_verts( const Topo & cage, size_t level ) {
+    uint64_t v = cage.NumVerts(), f = cage.NumFaces(), e = cage.edge.size(), c = cage.faceVert.index.size();
+    for( size_t l = 0; l < level; l++ ) {
+      v += f + e;
+      e = 2 * e + c;
+      f = c;
+      c = 4 * f;
+    }
+    return v;
+  }
+
+  // Sink writing each batch of tiles to an OBJ as its verts, normals and
+  // faces, which may only refer back to verts already written. Tiles are
+  // not welded, the file says so up front.
+  struct ObjTileWriter {
+    FILE * fp;
+    bool operator()( const TiledModel & tm ) {
+      if( tm.faceBegin == 0 ) {
+        fprintf( fp, "# level %d in %d tiles, one per cage face; verts on cage edges repeat in each tile\n",
+                 int( tm.level ), int( tm.tileVert.size() - 1 ) );
+      }
+      for( size_t i = 0; i < tm.vpos.size(); i++ ) {
+        fprintf( fp, "v %.9g %.9g %.9g\n", tm.vpos[i].x, tm.vpos[i].y, tm.vpos[i].z );
+      }
+      for( size_t i = 0; i < tm.vnrm.size(); i++ ) {
+        fprintf( fp, "vn %.6g %.6g %.6g\n", tm.vnrm[i].x, tm.vnrm[i].y, tm.vnrm[i].z );
+      }
+      for( size_t i = 0; i < tm.quads.size(); i += 4 ) {
+        unsigned long v[4];
+        for( size_t j = 0; j < 4; j++ ) {
+          v[j] = (unsigned long)tm.quads[ i + j ] + 1;
+        }
+        fprintf( fp, "f %lu//%lu %lu//%lu %lu//%lu %lu//%lu\n", v[0], v[0], v[1], v[1], v[2], v[2], v[3], v[3] );
+      }
+      return ferror( fp ) == 0;
+    }
+  };
+
+  // Writes the tiles held in tm as an OBJ file, each tile with its own verts.
+  bool save_obj( const char * path, const TiledModel & tm ) {
+    FILE * fp = fopen( path, "w" );
+    if( fp == NULL ) {
+      fprintf( stderr, "subdiv: cannot write %s\n", path );
+      return false;
+    }
+    ObjTileWriter w = { fp };
+    bool ok = w( tm );
+    if( fclose( fp ) != 0 || ! ok ) {
+      fprintf( stderr, "subdiv: cannot write %s\n", path );
+      return false;
+    }
+    return true;
+  }
+
+  // Refines cage to level tile batch by tile batch, see tiled_refine(),
+  // streaming the tiles to an OBJ file. tm is left with the layout and the
+  // last batch.
+  bool save_tiled_obj( const char * path, const Model & cage, size_t level, TiledModel & tm ) {
+    FILE * fp = fopen( path, "w" );
+    if( fp == NULL ) {
+      fprintf( stderr, "subdiv: cannot write %s\n", path );
+      return false;
+    }
+    ObjTileWriter w = { fp };
+    bool ok = tiled_refine( cage, level, tm, w );
+    bool written = ferror( fp ) == 0;
+    if( fclose( fp ) != 0 || ! written ) {
+      fprintf( stderr, "subdiv: cannot write %s\n", path );
+      ok = false;
+    }
+    if( ! ok ) {
+      remove( path );
+    }
+    return ok;
+  }
+}
+
+#endif // __SUBDIV_H__